@@ -0,0 +1,186 @@
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <ctime>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <nodar/zmq/bag.hpp>
+#include <nodar/zmq/endpoint.hpp>
+#include <nodar/zmq/multipart.hpp>
+#include <nodar/zmq/topic_ports.hpp>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zmq.hpp>
+
+std::atomic_bool running{true};
+
+void signalHandler(int signum) {
+    std::cerr << "SIGINT or SIGTERM received." << std::endl;
+    running = false;
+}
+
+// The topics that can be recorded
+std::vector<nodar::zmq::Topic> recordableTopics() {
+    std::vector<nodar::zmq::Topic> topics(nodar::zmq::IMAGE_TOPICS.begin(), nodar::zmq::IMAGE_TOPICS.end());
+    topics.push_back(nodar::zmq::SOUP_TOPIC);
+    topics.push_back(nodar::zmq::POINT_CLOUD_TOPIC);
+    topics.push_back(nodar::zmq::POINT_CLOUD_RGB_TOPIC);
+    topics.push_back(nodar::zmq::OBSTACLE_TOPIC);
+    topics.push_back(nodar::zmq::QA_FINDINGS_TOPIC);
+    topics.push_back(nodar::zmq::NAVIGATION_TOPIC);
+    return topics;
+}
+
+// Find a topic by its name or its port
+bool findTopic(const std::string& name_or_port, nodar::zmq::Topic& topic) {
+    for (const auto& candidate : recordableTopics()) {
+        if (name_or_port == candidate.name or name_or_port == std::to_string(candidate.port)) {
+            topic = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+void printUsage(const std::string& default_ip, const std::string& default_output_dir) {
+    std::cout << "You should specify the IP address of the device running hammerhead, the folder where you want the\n"
+                 "recording to be saved, and the topics (names or ports) that you want to record:\n\n"
+                 "     ./bag_recorder hammerhead_ip output_dir [topic ...]\n"
+                 "                    [--segment-size MiB] [--queue-depth count]\n\n"
+                 "e.g. ./bag_recorder 10.10.1.10 recordings nodar/topbot_raw nodar/obstacle\n\n"
+                 "If unspecified, we assume you are running this on the device running Hammerhead,\n"
+                 "and record the point cloud soup and the obstacles:\n\n"
+                 "     ./bag_recorder "
+              << default_ip << " " << default_output_dir << " " << nodar::zmq::SOUP_TOPIC.name << " "
+              << nodar::zmq::OBSTACLE_TOPIC.name << "\n\n"
+              << "Note that the list of topic/port mappings is in topic_ports.hpp in the zmq_msgs target.\n"
+              << "----------------------------------------" << std::endl;
+}
+
+std::string dateString() {
+    const auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    std::tm buf{};
+#if defined(_WIN32)
+    gmtime_s(&buf, &now);
+#else
+    gmtime_r(&now, &buf);
+#endif
+    std::ostringstream date_ss;
+    date_ss << std::put_time(&buf, "%Y%m%d-%H%M%S");
+    return date_ss.str();
+}
+
+int main(int argc, char* argv[]) {
+    static constexpr auto default_ip = "127.0.0.1";
+    static constexpr auto default_output_dir = ".";
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+
+    // How large each segment of the recording grows, and how many messages of each topic can wait to be written
+    uint64_t segment_size_mib = nodar::zmq::BagWriter::DEFAULT_SEGMENT_SIZE >> 20;
+    int queue_depth = 16;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if ((arg == "--segment-size" or arg == "--queue-depth") and i + 1 < argc) {
+            try {
+                const auto value = std::stoull(argv[++i]);
+                if (value == 0) {
+                    throw std::invalid_argument("0");
+                }
+                if (arg == "--segment-size") {
+                    segment_size_mib = value;
+                } else {
+                    queue_depth = static_cast<int>(value);
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "Invalid value " << argv[i] << " for " << arg << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (args.size() < 3) {
+        printUsage(default_ip, default_output_dir);
+    }
+    const auto ip = args.size() > 0 ? args[0] : default_ip;
+    const std::filesystem::path output_dir = args.size() > 1 ? args[1] : default_output_dir;
+    std::vector<nodar::zmq::Topic> topics;
+    for (size_t i = 2; i < args.size(); ++i) {
+        nodar::zmq::Topic topic{};
+        if (not findTopic(args[i], topic)) {
+            std::cerr << "It seems like you specified a topic " << args[i] << " that cannot be recorded." << std::endl;
+            return EXIT_FAILURE;
+        }
+        topics.push_back(topic);
+    }
+    if (topics.empty()) {
+        topics = {nodar::zmq::SOUP_TOPIC, nodar::zmq::OBSTACLE_TOPIC};
+    }
+
+    // One socket per topic, which are all polled by this thread. Every message is appended to the bag in the frames
+    // that it arrived in, so nothing is decoded, copied, or reassembled on the way to the disk.
+    zmq::context_t context(1);
+    std::vector<std::unique_ptr<zmq::socket_t>> sockets;
+    std::vector<zmq::pollitem_t> items;
+    for (const auto& topic : topics) {
+        sockets.emplace_back(new zmq::socket_t(context, ZMQ_SUB));
+        sockets.back()->set(zmq::sockopt::rcvhwm, queue_depth);
+        sockets.back()->set(zmq::sockopt::subscribe, "");
+        const auto endpoint = nodar::zmq::connectEndpoint(ip, topic);
+        sockets.back()->connect(endpoint);
+        std::cout << "Subscribing to " << topic.name << " on the endpoint " << endpoint << std::endl;
+        items.push_back({sockets.back()->handle(), 0, ZMQ_POLLIN, 0});
+    }
+
+    std::filesystem::create_directories(output_dir);
+    nodar::zmq::BagWriter bag((output_dir / dateString()).string(), segment_size_mib << 20);
+    std::vector<zmq::message_t> frames;
+    std::vector<uint64_t> recorded(topics.size(), 0);
+    auto last_report = std::chrono::steady_clock::now();
+    auto reported = bag.stats();
+    while (running) {
+        int ready = 0;
+        try {
+            ready = zmq::poll(items.data(), items.size(), 100);
+        } catch (const zmq::error_t& error) {
+            // A signal interrupts the wait, and then running tells whether we should stop
+            if (error.num() != EINTR) {
+                std::cerr << "Polling the recorded topics failed: " << error.what() << std::endl;
+            }
+            continue;
+        }
+        for (size_t i = 0; ready > 0 and i < items.size(); ++i) {
+            if (items[i].revents & ZMQ_POLLIN and
+                nodar::zmq::recvFrames(*sockets[i], frames, zmq::recv_flags::dontwait)) {
+                recorded[i] += bag.appendFrames(topics[i], frames);
+            }
+        }
+
+        // Every 5 seconds, report how much was recorded
+        const auto now = std::chrono::steady_clock::now();
+        if (now - last_report >= std::chrono::seconds(5)) {
+            const auto stats = bag.stats();
+            const auto seconds = std::chrono::duration<double>(now - last_report).count();
+            std::cout << std::string(60, '-') << "\nRecorded " << stats.messages << " messages, "
+                      << stats.bytes / (1 << 20) << " MiB in " << stats.segments << " segments ("
+                      << std::fixed << std::setprecision(1)
+                      << (stats.bytes - reported.bytes) / seconds / (1 << 20) << " MiB/s)" << std::endl;
+            for (size_t i = 0; i < topics.size(); ++i) {
+                std::cout << "  " << topics[i].name << ": " << recorded[i] << " messages" << std::endl;
+            }
+            last_report = now;
+            reported = stats;
+        }
+    }
+    if (not bag.close()) {
+        return EXIT_FAILURE;
+    }
+    std::cout << "Recorded " << bag.stats().messages << " messages." << std::endl;
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <tiffio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <nodar/zmq/image.hpp>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Writes StampedImages as uncompressed TIFF files in a single pass, straight from the received message.
+ *
+ * cv::imwrite needs a cv::Mat, and writing the metadata afterwards means opening the file again and rewriting its
+ * directory. This writer sets all the tags (including the metadata in the SOFTWARE tag) up front, and writes the strips
+ * with TIFFWriteRawStrip, so libtiff writes the image data from the message buffer without copying it,
+ * and writes the directory once, at the end. Only 3-channel images are copied (one strip at a time), since they are
+ * stored as BGR, and TIFF expects RGB (which is also what cv::imwrite writes).
+ *
+ * With direct_io (Linux only), the file is written with O_DIRECT, so that recording does not fill the page cache,
+ * and the kernel does not stall the writers to flush it. O_DIRECT needs block-aligned buffers, offsets and sizes,
+ * so the file is laid out in an aligned staging buffer first (which is reused for every image), and then written
+ * in whole blocks. If the file system does not support O_DIRECT (when opening or writing), then the file is written
+ * normally.
+ *
+ * A writer keeps scratch buffers, so use one writer per thread.
+ */
+class TiffWriter {
+public:
+    explicit TiffWriter(bool direct_io_arg = false) : direct_io(direct_io_arg) {}
+
+    TiffWriter(const TiffWriter&) = delete;
+    TiffWriter& operator=(const TiffWriter&) = delete;
+
+    // Whether the image can be written by this writer. Otherwise, fall back to cv::imwrite.
+    [[nodiscard]] static bool supports(const nodar::zmq::StampedImageView& image) {
+        const auto channels = nodar::zmq::StampedImage::channels(image.type);
+        return not image.empty() and (channels == 1 or channels == 3) and bitsPerSample(image.type) != 0;
+    }
+
+    /**
+     * Write image to path, with software as the SOFTWARE tag (unless it is empty).
+     * Returns false if the image is not supported, or if the file could not be written.
+     */
+    bool write(const std::filesystem::path& path, const nodar::zmq::StampedImageView& image,
+               const std::string& software = "") {
+        if (not supports(image)) {
+            return false;
+        }
+#ifdef __linux__
+        if (direct_io) {
+            staging.size = 0;
+            staging.offset = 0;
+            auto tiff = TIFFClientOpen(path.string().c_str(), "w", &staging, Staging::read, Staging::write,
+                                       Staging::seek, Staging::close, Staging::fileSize, Staging::map,
+                                       Staging::unmap);
+            return writeTiff(tiff, image, software) and flushDirect(path);
+        }
+#endif
+        return writeTiff(TIFFOpen(path.string().c_str(), "w"), image, software);
+    }
+
+private:
+    // Strips of about this many bytes, so that there are few strips, but each one is still cheap to swap
+    static constexpr size_t STRIP_BYTES = 1 << 20;
+
+    bool direct_io;
+    // Scratch space for converting one strip from BGR to RGB
+    std::vector<uint8_t> strip;
+
+    // The OpenCV depths, i.e. CV_8U, CV_8S, CV_16U, CV_16S, CV_32S, CV_32F and CV_64F
+    static uint16_t bitsPerSample(uint32_t type) {
+        static constexpr uint16_t BITS[] = {8, 8, 16, 16, 32, 32, 64, 0};
+        return BITS[nodar::zmq::StampedImage::depthType(type)];
+    }
+
+    static uint16_t sampleFormat(uint32_t type) {
+        static constexpr uint16_t FORMATS[] = {SAMPLEFORMAT_UINT,   SAMPLEFORMAT_INT,    SAMPLEFORMAT_UINT,
+                                               SAMPLEFORMAT_INT,    SAMPLEFORMAT_INT,    SAMPLEFORMAT_IEEEFP,
+                                               SAMPLEFORMAT_IEEEFP, SAMPLEFORMAT_UINT};
+        return FORMATS[nodar::zmq::StampedImage::depthType(type)];
+    }
+
+    bool writeTiff(TIFF* tiff, const nodar::zmq::StampedImageView& image, const std::string& software) {
+        if (not tiff) {
+            return false;
+        }
+        const auto channels = static_cast<uint16_t>(nodar::zmq::StampedImage::channels(image.type));
+        const auto bits = bitsPerSample(image.type);
+        const auto row_bytes = static_cast<size_t>(image.cols) * channels * (bits / 8);
+        const auto rows_per_strip =
+            static_cast<uint32_t>(std::min<size_t>(std::max<size_t>(1, STRIP_BYTES / row_bytes), image.rows));
+        TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, image.cols);
+        TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, image.rows);
+        TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, bits);
+        TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, channels);
+        TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, sampleFormat(image.type));
+        TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, channels == 3 ? PHOTOMETRIC_RGB : PHOTOMETRIC_MINISBLACK);
+        TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+        TIFFSetField(tiff, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+        TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, rows_per_strip);
+        if (not software.empty()) {
+            TIFFSetField(tiff, TIFFTAG_SOFTWARE, software.c_str());
+        }
+
+        bool success = true;
+        for (uint32_t row = 0, index = 0; row < image.rows and success; row += rows_per_strip, ++index) {
+            const auto rows = std::min(rows_per_strip, image.rows - row);
+            const auto bytes = rows * row_bytes;
+            auto data = const_cast<uint8_t*>(image.img.data()) + row * row_bytes;
+            if (channels == 3) {
+                data = bgrToRgb(data, bytes, bits / 8);
+            }
+            success = TIFFWriteRawStrip(tiff, index, data, static_cast<tmsize_t>(bytes)) ==
+                      static_cast<tmsize_t>(bytes);
+        }
+        success = TIFFWriteDirectory(tiff) and success;
+        TIFFClose(tiff);
+        return success;
+    }
+
+    // Copy a strip of BGR pixels into the scratch strip, swapping the blue and red samples
+    uint8_t* bgrToRgb(const uint8_t* src, size_t bytes, size_t sample_bytes) {
+        strip.resize(bytes);
+        switch (sample_bytes) {
+            case 1:
+                swapSamples<uint8_t>(src, strip.data(), bytes);
+                break;
+            case 2:
+                swapSamples<uint16_t>(src, strip.data(), bytes);
+                break;
+            case 4:
+                swapSamples<uint32_t>(src, strip.data(), bytes);
+                break;
+            default:
+                swapSamples<uint64_t>(src, strip.data(), bytes);
+                break;
+        }
+        return strip.data();
+    }
+
+    // The samples are copied with a fixed size, so that the compiler turns each copy into a single (unaligned) load
+    // or store, rather than calling memcpy for every sample
+    template <typename Sample>
+    static void swapSamples(const uint8_t* src, uint8_t* dst, size_t bytes) {
+        const auto end = src + bytes;
+        Sample b, g, r;
+        for (; src != end; src += 3 * sizeof(Sample), dst += 3 * sizeof(Sample)) {
+            std::memcpy(&b, src, sizeof(Sample));
+            std::memcpy(&g, src + sizeof(Sample), sizeof(Sample));
+            std::memcpy(&r, src + 2 * sizeof(Sample), sizeof(Sample));
+            std::memcpy(dst, &r, sizeof(Sample));
+            std::memcpy(dst + sizeof(Sample), &g, sizeof(Sample));
+            std::memcpy(dst + 2 * sizeof(Sample), &b, sizeof(Sample));
+        }
+    }
+
+#ifdef __linux__
+    // The alignment of the buffers, offsets and sizes of O_DIRECT writes, which covers common block sizes
+    static constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+
+    // An in-memory file, which libtiff writes into through the client procs of TIFFClientOpen
+    struct Staging {
+        std::unique_ptr<uint8_t, decltype(&std::free)> data{nullptr, &std::free};
+        size_t capacity = 0;
+        size_t size = 0;
+        size_t offset = 0;
+
+        // Grow the buffer to hold at least bytes (rounded up to whole blocks), keeping its contents
+        bool reserve(size_t bytes) {
+            if (bytes <= capacity) {
+                return true;
+            }
+            const auto new_capacity =
+                (std::max(bytes, 2 * capacity) + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+            std::unique_ptr<uint8_t, decltype(&std::free)> grown(
+                static_cast<uint8_t*>(std::aligned_alloc(DIRECT_IO_ALIGNMENT, new_capacity)), &std::free);
+            if (not grown) {
+                return false;
+            }
+            if (size > 0) {
+                std::memcpy(grown.get(), data.get(), size);
+            }
+            data = std::move(grown);
+            capacity = new_capacity;
+            return true;
+        }
+
+        static tmsize_t read(thandle_t handle, void* buffer, tmsize_t count) {
+            auto& self = *static_cast<Staging*>(handle);
+            const auto available = self.offset < self.size ? self.size - self.offset : 0;
+            const auto bytes = std::min(static_cast<size_t>(count), available);
+            std::memcpy(buffer, self.data.get() + self.offset, bytes);
+            self.offset += bytes;
+            return static_cast<tmsize_t>(bytes);
+        }
+
+        static tmsize_t write(thandle_t handle, void* buffer, tmsize_t count) {
+            auto& self = *static_cast<Staging*>(handle);
+            const auto end = self.offset + static_cast<size_t>(count);
+            if (not self.reserve(end)) {
+                return -1;
+            }
+            // libtiff may seek past the end, and expects the gap to read as zeros
+            if (self.offset > self.size) {
+                std::memset(self.data.get() + self.size, 0, self.offset - self.size);
+            }
+            std::memcpy(self.data.get() + self.offset, buffer, static_cast<size_t>(count));
+            self.offset = end;
+            self.size = std::max(self.size, end);
+            return count;
+        }
+
+        static toff_t seek(thandle_t handle, toff_t offset, int whence) {
+            auto& self = *static_cast<Staging*>(handle);
+            const auto base = whence == SEEK_CUR ? self.offset : whence == SEEK_END ? self.size : 0;
+            self.offset = base + static_cast<size_t>(offset);
+            return self.offset;
+        }
+
+        static int close(thandle_t) { return 0; }
+
+        static toff_t fileSize(thandle_t handle) { return static_cast<Staging*>(handle)->size; }
+
+        static int map(thandle_t, void**, toff_t*) { return 0; }
+
+        static void unmap(thandle_t, void*, toff_t) {}
+    };
+
+    Staging staging;
+
+    // Write the staged file in whole blocks, and then cut off the padding of the last block
+    bool flushDirect(const std::filesystem::path& path) {
+        const auto padded = (staging.size + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+        if (not staging.reserve(padded)) {
+            std::cerr << "Could not write " << path << ": out of memory" << std::endl;
+            return false;
+        }
+        std::memset(staging.data.get() + staging.size, 0, padded - staging.size);
+        auto fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        auto success = fd >= 0 and writeAll(fd, padded);
+        if (not success and errno == EINVAL) {
+            // The file system does not support O_DIRECT (e.g. tmpfs), either when opening, or when writing
+            // (e.g. some NFS mounts), so write the file normally
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            success = fd >= 0 and writeAll(fd, padded);
+        }
+        success = success and ::ftruncate(fd, static_cast<off_t>(staging.size)) == 0;
+        if (not success) {
+            std::cerr << "Could not write " << path << ": " << std::strerror(errno) << std::endl;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return success;
+    }
+
+    // Write the first size bytes of the staging buffer. Returns false, with errno set, if a write fails.
+    bool writeAll(int fd, size_t size) {
+        for (size_t written = 0; written < size;) {
+            const auto result = ::write(fd, staging.data.get() + written, size - written);
+            if (result < 0 and errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                errno = result == 0 ? EIO : errno;
+                return false;
+            }
+            written += static_cast<size_t>(result);
+        }
+        return true;
+    }
+#endif
+};
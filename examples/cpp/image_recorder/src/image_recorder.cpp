@@ -1,22 +1,32 @@
-#include <tiffio.h>
-
+#include <algorithm>
 #include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <condition_variable>
 #include <csignal>
-#include <deque>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <nodar/zmq/endpoint.hpp>
+#include <nodar/zmq/frame_stats.hpp>
 #include <nodar/zmq/image.hpp>
+#include <nodar/zmq/multipart.hpp>
 #include <nodar/zmq/opencv_utils.hpp>
 #include <nodar/zmq/topic_ports.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 #include <zmq.hpp>
 
+#include "tiff_writer.hpp"
+
 std::atomic_bool running{true};
 
 void signalHandler(int signum) {
@@ -40,14 +50,9 @@ void printDetails(const cv::Mat& mat) {
               << std::endl;
 }
 
-// Add timestamp and camera parameters metadata to TIFF file (compatible with Hammerhead viewer format)
-bool add_tiff_metadata(const std::filesystem::path& filename, uint64_t left_time, uint64_t right_time,
-                       float exposure = 0.0f, float gain = 0.0f) {
-    TIFF* tiff = TIFFOpen(filename.c_str(), "r+");
-    if (!tiff) {
-        return false;
-    }
-
+// The timestamp and camera parameters metadata of a TIFF file (compatible with Hammerhead viewer format),
+// which is embedded in the SOFTWARE tag
+std::string tiff_metadata(uint64_t left_time, uint64_t right_time, float exposure = 0.0f, float gain = 0.0f) {
     // Create YAML string with all required fields (compatible with Hammerhead format)
     // Must include all fields that DetailsParameters expects
     std::ostringstream details_str;
@@ -64,80 +69,54 @@ bool add_tiff_metadata(const std::filesystem::path& filename, uint64_t left_time
 
     std::ostringstream metadata_yaml;
     metadata_yaml << "DETAILS: \"" << details_str.str() << "\"";
-
-    // Embed metadata in the SOFTWARE tag using libtiff
-    bool success = TIFFSetField(tiff, TIFFTAG_SOFTWARE, metadata_yaml.str().c_str());
-    TIFFClose(tiff);
-    return success;
+    return metadata_yaml.str();
 }
 
-class FPS {
-public:
-    // Store timestamps for up to 100 frames
-    explicit FPS(size_t maxlen = 100) : frame_times(), start_time(), total_frames(0), maxlen(maxlen) {}
-
-    /** Call this once per frame. **/
-    void tic() {
-        auto now = Clock::now();
-        if (total_frames == 0) {
-            start_time = now;
-        }
-        frame_times.push_back(now);
-        if (frame_times.size() > maxlen) {
-            frame_times.pop_front();
-        }
-        ++total_frames;
-    }
-
-    /** Compute FPS over the last n frames (if enough data). **/
-    [[nodiscard]] double fps_over_window(size_t n) const {
-        if (frame_times.size() < 2) {
-            return 0.0;
-        }
-        if (frame_times.size() < n) {
-            n = frame_times.size();
-        }
-        const auto t1 = frame_times[frame_times.size() - n];
-        const auto t2 = frame_times.back();
-        const std::chrono::duration<double> delta = t2 - t1;
-        return (t2 == t1) ? 0.0 : static_cast<double>(n - 1) / delta.count();
-    }
-
-    [[nodiscard]] auto str() const {
-        const double fps_100 = fps_over_window(100);
-        std::ostringstream ss;
-        ss << std::fixed << std::setprecision(2) << "fps_100: " << fps_100 << ", fps_inf: ";
-        if (total_frames <= 1) {
-            ss << 0.0;
-        } else {
-            const std::chrono::duration<double> total_time = frame_times.back() - start_time;
-            ss << static_cast<double>(total_frames - 1) / total_time.count();
-        }
-        return ss.str();
-    }
-
-private:
-    using Clock = std::chrono::steady_clock;
-    std::deque<Clock::time_point> frame_times;
-    Clock::time_point start_time;
-    size_t total_frames;
-    size_t maxlen;
+// What the write pipeline has done so far, so that the queue depth and the number of writers can be sized
+struct PipelineStats {
+    uint64_t queued{0};  // Number of frames that were queued to be written
+    uint64_t written{0};  // Number of frames that were written
+    uint64_t dropped{0};  // Number of frames that were dropped, because the queue was full
+    size_t queue_depth{0};  // The number of frames that are waiting to be written at the moment
+    size_t queue_high_water_mark{0};  // The largest number of frames that were ever waiting at once
 };
 
+/**
+ * Records the images of one topic.
+ *
+ * The thread that calls loop_once only receives the images, and queues them, still in the ZMQ messages that they
+ * arrived in (in either wire mode, see multipart.hpp), so that it is always ready for the next image. A pool of
+ * writer threads takes the images from the queue, and writes them (with their time stamps). So a slow disk only fills
+ * the queue, rather than making the receiver miss images. If the queue is full, then the newest image is dropped
+ * (and counted in PipelineStats).
+ *
+ * The images are written with a TiffWriter, straight from the messages, with their metadata, in one pass
+ * (and with O_DIRECT if direct_io is set). Image types that it does not support are written with cv::imwrite.
+ */
 class ZMQImageRecorder {
 public:
     static constexpr auto additional_data_size = 16;
 
     ZMQImageRecorder(const std::string& endpoint,  //
                      const std::filesystem::path& output_dir,  //
-                     const std::string& image_dirname)
+                     const std::string& image_dirname,  //
+                     size_t writer_count,  //
+                     size_t queue_depth,  //
+                     bool direct_io_arg)
         : context(1),
           socket(context, ZMQ_SUB),
           image_dir(output_dir / image_dirname),
           timing_dir(output_dir / "times"),
-          timing_file(output_dir / "times.txt") {
+          timing_file(output_dir / "times.txt"),
+          frame_stats(endpoint),
+          reporter(std::chrono::seconds(10), std::cerr),
+          direct_io(direct_io_arg),
+          queued(std::max<size_t>(queue_depth, 1)) {
         const int hwm = 1;  // set maximum queue length to 1 message
         socket.set(zmq::sockopt::rcvhwm, hwm);
+        // Wake up regularly, so that Ctrl+C is noticed even if no images arrive
+        const int receive_timeout_ms = 100;
+        socket.set(zmq::sockopt::rcvtimeo, receive_timeout_ms);
         socket.set(zmq::sockopt::subscribe, "");
         socket.connect(endpoint);
         std::cout << "Subscribing to " << endpoint << std::endl;
@@ -147,6 +126,27 @@ public:
         std::filesystem::create_directories(timing_dir);
         compression_params.push_back(cv::IMWRITE_TIFF_COMPRESSION);
         compression_params.push_back(1);  // No compression
+        // Periodically report the frame rate, dropped frames, and the latency of the images
+        reporter.add(frame_stats);
+        std::cout << "Writing images with " << std::max<size_t>(writer_count, 1) << " threads, with up to "
+                  << queued.size() << " images waiting to be written" << (direct_io ? ", with O_DIRECT" : "")
+                  << std::endl;
+        for (size_t i = 0; i < std::max<size_t>(writer_count, 1); ++i) {
+            writers.emplace_back(&ZMQImageRecorder::write_loop, this);
+        }
+    }
+
+    // Write the images that are still queued, and stop the writers
+    ~ZMQImageRecorder() {
+        {
+            std::lock_guard<std::mutex> lock(queue_guard);
+            stopping = true;
+        }
+        frame_queued.notify_all();
+        for (auto& writer : writers) {
+            writer.join();
+        }
+        print_pipeline_stats();
     }
 
     [[nodiscard]] static std::string frame_string(uint64_t frame_no) {
@@ -156,43 +156,141 @@ public:
     }
 
     void loop_once() {
-        fps.tic();
-        zmq::message_t msg;
-        const auto received_bytes = socket.recv(msg, zmq::recv_flags::none);
-        const nodar::zmq::StampedImage stamped_image(static_cast<uint8_t*>(msg.data()));
-        auto img = nodar::zmq::cvMatFromStampedImage(stamped_image);
+        auto frames = std::make_shared<std::vector<zmq::message_t>>();
+        try {
+            if (not nodar::zmq::recvFrames(socket, *frames)) {
+                report_pipeline_stats();
+                return;
+            }
+        } catch (const zmq::error_t& error) {
+            // A signal interrupts the wait, and then running tells whether we should stop
+            if (error.num() != EINTR) {
+                std::cerr << "\nReceiving an image failed: " << error.what() << std::endl;
+            }
+            return;
+        }
+        // The view references the frames, instead of copying the image out of them,
+        // and keeps them alive until a writer is done with them
+        auto stamped_image = nodar::zmq::viewStampedImage(*frames, frames);
+        const auto img = nodar::zmq::cvMatViewFromStampedImage(stamped_image);
         if (img.empty()) {
             return;
         }
-        const auto& frame_id = stamped_image.frame_id;
-        std::cout << "\rFrame # " << frame_id << ", Last #: " << last_frame_id  //
+        size_t msg_size = 0;
+        for (const auto& frame : *frames) {
+            msg_size += frame.size();
+        }
+        const auto frame_id = stamped_image.frame_id;
+        const auto dropped = frame_stats.record(stamped_image, msg_size);
+        std::cout << "\rFrame # " << frame_id  //
                   << ", img.shape = " << img.rows << "x" << img.cols << "x" << img.channels()  //
                   << ", img.dtype = " << img.type() << ". ";
-        std::cout << fps.str() << ". ";
-        if (last_frame_id != 0 and frame_id != last_frame_id + 1) {
-            std::cout << "Frames dropped: " << frame_id - last_frame_id - 1 << ". ";
+        std::cout << std::fixed << std::setprecision(2) << "fps: " << update_fps() << ". ";
+        if (dropped != 0) {
+            std::cout << "Frames dropped: " << dropped << ". ";
         }
         std::cout << std::flush;
-        last_frame_id = frame_id;
+        enqueue(std::move(stamped_image));
+        report_pipeline_stats();
+    }
 
-        // We recommend saving tiffs with no compression if the data rate is high.
-        // Depending on the underlying image type, you might want to use stamped_image.cvt_to_bgr_code
-        // to convert to BGR before saving.
-        const auto frame_str = frame_string(frame_id);
-        const auto tiff_path = image_dir / (frame_str + ".tiff");
-        cv::imwrite(tiff_path, img, compression_params);
+private:
+    using Clock = std::chrono::steady_clock;
 
+    zmq::context_t context;
+    zmq::socket_t socket;
+    std::filesystem::path image_dir;
+    std::filesystem::path timing_dir;
+    std::mutex timing_file_guard;
+    std::ofstream timing_file;
+    std::vector<int> compression_params;
+    nodar::zmq::FrameStats frame_stats;
+    nodar::zmq::FrameStatsReporter reporter;
+    bool direct_io;
+
+    // A ring of the images that are waiting to be written
+    std::mutex queue_guard;
+    std::condition_variable frame_queued;
+    std::vector<nodar::zmq::StampedImageView> queued;
+    size_t queue_head = 0;
+    size_t queue_count = 0;
+    bool stopping = false;
+    PipelineStats pipeline_stats;
+    // How long each image took to write, in ns
+    nodar::zmq::Histogram write_times;
+    Clock::time_point last_report = Clock::now();
+    // The frame rate over the last second, counted here rather than taken from frame_stats, which is too
+    // expensive to summarize for every frame
+    double fps = 0.0;
+    size_t fps_frames = 0;
+    Clock::time_point fps_start = Clock::now();
+    std::vector<std::thread> writers;
+
+    void enqueue(nodar::zmq::StampedImageView&& stamped_image) {
+        {
+            std::lock_guard<std::mutex> lock(queue_guard);
+            if (queue_count == queued.size()) {
+                ++pipeline_stats.dropped;
+                return;
+            }
+            queued[(queue_head + queue_count) % queued.size()] = std::move(stamped_image);
+            ++queue_count;
+            ++pipeline_stats.queued;
+            pipeline_stats.queue_high_water_mark = std::max(pipeline_stats.queue_high_water_mark, queue_count);
+        }
+        frame_queued.notify_one();
+    }
+
+    void write_loop() {
+        TiffWriter tiff_writer(direct_io);
+        nodar::zmq::StampedImageView stamped_image;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(queue_guard);
+                frame_queued.wait(lock, [this] { return queue_count > 0 or stopping; });
+                if (queue_count == 0) {
+                    return;
+                }
+                stamped_image = std::move(queued[queue_head]);
+                queue_head = (queue_head + 1) % queued.size();
+                --queue_count;
+            }
+            const auto start = Clock::now();
+            write(tiff_writer, stamped_image);
+            // Release the message now, rather than when the next image is taken
+            stamped_image = nodar::zmq::StampedImageView();
+            const auto write_time = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+            write_times.record(static_cast<uint64_t>(write_time.count()));
+            std::lock_guard<std::mutex> lock(queue_guard);
+            ++pipeline_stats.written;
+        }
+    }
+
+    void write(TiffWriter& tiff_writer, const nodar::zmq::StampedImageView& stamped_image) {
         // Extract right_time, exposure, and gain from additional_field (for topbot messages)
         uint64_t right_time = 0;
         float exposure = 0.0f;
         float gain = 0.0f;
+        std::string metadata;
         if (stamped_image.additional_field_size == additional_data_size) {
             memcpy(&right_time, stamped_image.additional_field.data(), 8);
             memcpy(&exposure, stamped_image.additional_field.data() + 8, 4);
             memcpy(&gain, stamped_image.additional_field.data() + 12, 4);
+            metadata = tiff_metadata(stamped_image.time, right_time, exposure, gain);
+        }
 
-            // Add timestamp and camera parameters metadata to TIFF file
-            add_tiff_metadata(tiff_path, stamped_image.time, right_time, exposure, gain);
+        // We save tiffs with no compression, since the data rate is high.
+        // Depending on the underlying image type, you might want to use stamped_image.cvt_to_bgr_code
+        // to convert to BGR before saving.
+        const auto frame_str = frame_string(stamped_image.frame_id);
+        const auto tiff_path = image_dir / (frame_str + ".tiff");
+        if (TiffWriter::supports(stamped_image)) {
+            if (not tiff_writer.write(tiff_path, stamped_image, metadata)) {
+                std::cerr << "\nCould not write " << tiff_path << std::endl;
+            }
+        } else {
+            // Without the metadata
+            cv::imwrite(tiff_path, nodar::zmq::cvMatViewFromStampedImage(stamped_image), compression_params);
         }
         {
             std::ofstream f(timing_dir / (frame_str + ".txt"));
@@ -202,22 +300,52 @@ public:
             }
             f << std::flush;
         }
-        timing_file << frame_string(frame_id) << " " << stamped_image.time;
+        // The writers finish out of order, so the lines of times.txt are not necessarily sorted by frame
+        std::lock_guard<std::mutex> lock(timing_file_guard);
+        timing_file << frame_str << " " << stamped_image.time;
         if (stamped_image.additional_field_size == additional_data_size) {
             timing_file << " " << right_time << " " << exposure << " " << gain;
         }
         timing_file << std::endl;
     }
 
-private:
-    zmq::context_t context;
-    zmq::socket_t socket;
-    uint64_t last_frame_id = 0;
-    std::filesystem::path image_dir;
-    std::filesystem::path timing_dir;
-    std::ofstream timing_file;
-    std::vector<int> compression_params;
-    FPS fps;
+    // Count a received frame, and return the frame rate over the last interval of at least a second
+    double update_fps() {
+        ++fps_frames;
+        const auto now = Clock::now();
+        const std::chrono::duration<double> elapsed = now - fps_start;
+        if (elapsed.count() >= 1.0) {
+            fps = static_cast<double>(fps_frames) / elapsed.count();
+            fps_frames = 0;
+            fps_start = now;
+        }
+        return fps;
+    }
+
+    // Every 10 seconds, report how full the queue is, and how long the images take to write
+    void report_pipeline_stats() {
+        const auto now = Clock::now();
+        if (now - last_report < std::chrono::seconds(10)) {
+            return;
+        }
+        last_report = now;
+        print_pipeline_stats();
+    }
+
+    void print_pipeline_stats() {
+        PipelineStats stats;
+        {
+            std::lock_guard<std::mutex> lock(queue_guard);
+            stats = pipeline_stats;
+            stats.queue_depth = queue_count;
+        }
+        const auto times = write_times.snapshot();
+        std::cerr << "\nWrite queue: " << stats.queue_depth << " of " << queued.size() << " waiting (at most "
+                  << stats.queue_high_water_mark << "), " << stats.queued << " queued, " << stats.written
+                  << " written, " << stats.dropped << " dropped because the queue was full. Write time: p50 "
+                  << times.percentile(0.5) / 1000000.0 << " ms, p99 " << times.percentile(0.99) / 1000000.0
+                  << " ms, max " << times.max() / 1000000.0 << " ms" << std::endl;
+    }
 };
 
 std::string get_folder_name(const std::string& topic_name) {
@@ -254,7 +382,8 @@ void print_usage(const std::string& default_ip, const std::string& default_port,
     std::cout << "You should specify the IP address of the ZMQ source (the device running Hammerhead), \n"
                  "the port number of the message that you want to listen to, \n"
                  "and the folder where you want the data to be saved:\n\n"
-                 "     ./image_recorder hammerhead_ip port output_dir\n\n"
+                 "     ./image_recorder hammerhead_ip port output_dir\n"
+                 "                      [--writers count] [--queue-depth count] [--direct-io]\n\n"
                  "e.g. ./image_recorder 192.168.1.9 9800 recorded_images\n\n"
                  "Alternatively, you can specify one of the image topic names in topic_ports.hpp of zmq_msgs...\n\n"
                  "e.g. ./image_recorder 192.168.1.9 nodar/right/image_raw recorded_images\n\n"
@@ -287,6 +416,34 @@ int main(int argc, char* argv[]) {
 
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
+
+    // How many threads write the images, and how many images can wait for them.
+    // If the write queue report shows that images are dropped because the queue was full, increase these.
+    size_t writer_count = 2;
+    size_t queue_depth = 16;
+    // Write the images with O_DIRECT (on Linux), so that recording does not fill the page cache
+    bool direct_io = false;
+    while (argc >= 2) {
+        if (std::string(argv[argc - 1]) == "--direct-io") {
+            direct_io = true;
+            --argc;
+            continue;
+        }
+        if (argc < 3) {
+            break;
+        }
+        const std::string flag = argv[argc - 2];
+        size_t* option = flag == "--writers" ? &writer_count : flag == "--queue-depth" ? &queue_depth : nullptr;
+        if (not option) {
+            break;
+        }
+        std::istringstream iss(argv[argc - 1]);
+        if (not(iss >> *option) or *option == 0) {
+            std::cerr << "Invalid value " << argv[argc - 1] << " for " << flag << std::endl;
+            return EXIT_FAILURE;
+        }
+        argc -= 2;
+    }
     if (argc < 4) {
         print_usage(default_ip, default_port, default_output_dir);
     }
@@ -330,9 +487,10 @@ int main(int argc, char* argv[]) {
     }
 
     const auto output_dir = argc >= 4 ? (std::string(argv[3]) + "/" + dated_folder) : default_output_dir;
-    const auto endpoint = std::string("tcp://") + ip + ":" + std::to_string(topic.port);
+    const auto endpoint = nodar::zmq::connectEndpoint(ip, topic);
     std::filesystem::create_directories(output_dir);
-    ZMQImageRecorder subscriber(endpoint, output_dir, get_folder_name(topic.name));
+    ZMQImageRecorder subscriber(endpoint, output_dir, get_folder_name(topic.name), writer_count, queue_depth,
+                                direct_io);
     while (running) {
         subscriber.loop_once();
     }
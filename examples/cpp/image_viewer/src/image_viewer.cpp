@@ -1,11 +1,19 @@
 #include <atomic>
+#include <chrono>
 #include <csignal>
 #include <iostream>
+#include <memory>
+#include <nodar/zmq/conflating_subscriber.hpp>
+#include <nodar/zmq/endpoint.hpp>
+#include <nodar/zmq/frame_stats.hpp>
 #include <nodar/zmq/image.hpp>
+#include <nodar/zmq/multipart.hpp>
 #include <nodar/zmq/opencv_utils.hpp>
+#include <nodar/zmq/shared_memory.hpp>
 #include <nodar/zmq/topic_ports.hpp>
 #include <opencv2/highgui.hpp>
 #include <unordered_map>
+#include <vector>
 #include <zmq.hpp>
 
 std::atomic_bool running{true};
@@ -33,22 +41,46 @@ void printDetails(const cv::Mat &mat) {
 
 class ZMQImageViewer {
 public:
-    uint64_t last_frame_id = 0;
+    nodar::zmq::FrameStats frame_stats;
 
-    ZMQImageViewer(const std::string &endpoint) : context(1), socket(context, ZMQ_SUB), window_name(endpoint) {
-        const int hwm = 1;  // set maximum queue length to 1 message
-        socket.set(zmq::sockopt::rcvhwm, hwm);
-        socket.set(zmq::sockopt::subscribe, "");
-        socket.connect(endpoint);
-        std::cout << "Subscribing to " << endpoint << std::endl;
+    // Only ever display the newest image
+    ZMQImageViewer(const std::string &endpoint)
+        : frame_stats(endpoint),
+          latest(new nodar::zmq::ConflatingSubscriber(endpoint)),
+          window_name(endpoint) {
         cv::namedWindow(window_name, cv::WINDOW_NORMAL);
+        reporter.add(frame_stats);
+    }
+
+    // Read the images in place from the shared memory ring of a publisher on this host (see shared_memory.hpp)
+    explicit ZMQImageViewer(uint16_t port)
+        : frame_stats(nodar::zmq::sharedMemoryEndpoint(port)),
+          context(new zmq::context_t(1)),
+          shared_memory(new nodar::zmq::SharedMemorySubscriber(*context, port)),
+          window_name(nodar::zmq::sharedMemoryEndpoint(port)) {
+        cv::namedWindow(window_name, cv::WINDOW_NORMAL);
+        reporter.add(frame_stats);
     }
 
     void loopOnce() {
-        zmq::message_t msg;
-        const auto received_bytes = socket.recv(msg, zmq::recv_flags::none);
-        const nodar::zmq::StampedImage stamped_image(static_cast<uint8_t *>(msg.data()));
-        auto img = nodar::zmq::cvMatFromStampedImage(stamped_image);
+        nodar::zmq::StampedImageView stamped_image;
+        nodar::zmq::SharedMemoryMessage shared;
+        if (shared_memory) {
+            shared = shared_memory->recv();
+            if (shared.empty()) {
+                return;
+            }
+            stamped_image = nodar::zmq::StampedImageView(shared.data.data(), shared.data.size(), shared.owner);
+        } else {
+            // Images may arrive as a single frame, or as multiple frames (see nodar/zmq/multipart.hpp)
+            const auto frames = latest->waitForNext();
+            if (not frames) {
+                return;
+            }
+            // The view and the cv::Mat below both reference the frames, instead of copying the image out of them
+            stamped_image = nodar::zmq::viewStampedImage(*frames, frames);
+        }
+        auto img = nodar::zmq::cvMatViewFromStampedImage(stamped_image);
         if (img.type() == CV_16SC1) {
             // Highgui produces a strange-looking output for signed 16-bit images. Convert to unsigned
             img.convertTo(img, CV_16UC1);
@@ -57,16 +89,17 @@ public:
             return;
         }
         const auto &frame_id = stamped_image.frame_id;
-        if (last_frame_id != 0 and frame_id != last_frame_id + 1) {
-            std::cerr << (frame_id - last_frame_id - 1) << " frames dropped. Current frame ID : " << frame_id
-                      << ", last frame ID: " << last_frame_id << std::endl;
-        }
-        last_frame_id = frame_id;
+        // Only the newest image is shown, so frames are skipped whenever displaying is slower than the stream.
+        // The reporter sums up the gaps every few seconds, rather than warning about each one.
+        frame_stats.record(stamped_image, stamped_image.msgSize());
         std::cout << "\rFrame # " << frame_id << std::flush;
 
         // Downsize the image before viewing
         cv::resizeWindow(window_name, {640, 480});
         cv::imshow(window_name, img);
+        if (shared_memory and not shared.valid()) {
+            std::cerr << "Frame " << frame_id << " was overwritten while it was being displayed." << std::endl;
+        }
         cv::waitKey(1);
         // You can try checking if the window is still visible, and stop if it is not.
         // However, that OpenCV function appears buggy on many systems.
@@ -79,9 +112,12 @@ public:
     }
 
 private:
-    zmq::context_t context;
-    zmq::socket_t socket;
+    // The ConflatingSubscriber has a context of its own, so this is only set for shared memory
+    std::unique_ptr<zmq::context_t> context;
+    std::unique_ptr<nodar::zmq::ConflatingSubscriber> latest;
+    std::unique_ptr<nodar::zmq::SharedMemorySubscriber> shared_memory;
     std::string window_name;
+    nodar::zmq::FrameStatsReporter reporter{std::chrono::seconds(10), std::cerr};
 };
 
 void printUsage(const std::string &default_ip, const std::string &default_port) {
@@ -137,14 +173,17 @@ int main(int argc, char *argv[]) {
             }
         }
     }
-    std::string endpoint;
-    if (is_port_number) {
-        endpoint = "tcp://" + std::string(ip) + ":" + std::to_string(port);
+    if (not is_port_number) {
+        port = topic.port;
+    }
+    // Publishers on this host may serve the images over shared memory, which saves copying them through a socket
+    std::unique_ptr<ZMQImageViewer> subscriber;
+    if (nodar::zmq::sharedMemoryAvailable(ip, port)) {
+        subscriber.reset(new ZMQImageViewer(port));
     } else {
-        endpoint = "tcp://" + std::string(ip) + ":" + std::to_string(topic.port);
+        subscriber.reset(new ZMQImageViewer(nodar::zmq::connectEndpoint(ip, port)));
     }
-    ZMQImageViewer subscriber(endpoint);
     while (running) {
-        subscriber.loopOnce();
+        subscriber->loopOnce();
     }
 }
@@ -18,10 +18,7 @@ public:
     }
 
     bool publishNavigation(const nodar::zmq::NavigationData& nav_data) {
-        auto buffer = publisher.getBuffer();
-        buffer->resize(nav_data.msgSize());
-        nav_data.write(buffer->data());
-        publisher.send(buffer);
+        publisher.publish(nav_data);
         return true;
     }
 
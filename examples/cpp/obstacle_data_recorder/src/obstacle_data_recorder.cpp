@@ -1,11 +1,13 @@
 #include <atomic>
+#include <chrono>
 #include <csignal>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <nodar/zmq/frame_stats.hpp>
 #include <nodar/zmq/obstacle_data.hpp>
+#include <nodar/zmq/subscriber.hpp>
 #include <nodar/zmq/topic_ports.hpp>
-#include <zmq.hpp>
 
 std::atomic_bool running{true};
 
@@ -28,29 +30,21 @@ inline void write_data(const std::string &filename, const nodar::zmq::ObstacleDa
 
 class ObstacleDataSink {
 public:
-    uint64_t last_frame_id = 0;
-
-    ObstacleDataSink(const std::filesystem::path &output_dir, const std::string &endpoint)
-        : output_dir(output_dir), context(1), socket(context, ZMQ_SUB) {
-        const int hwm = 1;  // set maximum queue length to 1 message
-        socket.set(zmq::sockopt::rcvhwm, hwm);
-        socket.set(zmq::sockopt::subscribe, "");
-        socket.connect(endpoint);
-        std::cout << "Subscribing to " << endpoint << std::endl;
+    ObstacleDataSink(const std::filesystem::path &output_dir, const nodar::zmq::Topic &topic, const std::string &ip)
+        : output_dir(output_dir), subscriber(topic, ip), reporter(std::chrono::seconds(10), std::cerr) {
+        // Periodically report dropped frames, and the latency of the obstacles, as seen by the subscriber
+        reporter.add(subscriber.frameStats());
     }
 
     void loopOnce() {
-        zmq::message_t msg;
-        const auto received_bytes = socket.recv(msg, zmq::recv_flags::none);
-        const nodar::zmq::ObstacleData obstacleData{static_cast<uint8_t *>(msg.data())};
-        const auto &frame_id = obstacleData.frame_id;
-
-        // Warn if we dropped a frame
-        if ((last_frame_id != 0) and (frame_id != last_frame_id + 1)) {
-            std::cerr << (frame_id - last_frame_id - 1) << " frames dropped. Current frame ID : " << frame_id
-                      << ", last frame ID: " << last_frame_id << std::endl;
+        // The subscriber receives and decodes the next message in the background, while we write this one to disk.
+        // Waiting times out regularly, so that we notice when we should stop.
+        const auto message = subscriber.waitForNext();
+        if (not message) {
+            return;
         }
-        last_frame_id = frame_id;
+        const auto &obstacleData = *message;
+        const auto &frame_id = obstacleData.frame_id;
         std::cout << "\rFrame # " << frame_id << ". " << std::flush;
 
         std::ostringstream filename_ss;
@@ -62,8 +56,8 @@ public:
 
 private:
     std::filesystem::path output_dir;
-    zmq::context_t context;
-    zmq::socket_t socket;
+    nodar::zmq::Subscriber<nodar::zmq::ObstacleData> subscriber;
+    nodar::zmq::FrameStatsReporter reporter;
 };
 
 void printUsage(const std::string &default_ip) {
@@ -85,13 +79,12 @@ int main(int argc, char *argv[]) {
         printUsage(default_ip);
     }
     const auto ip{argc > 1 ? argv[1] : default_ip};
-    const auto endpoint{std::string("tcp://") + ip + ":" + std::to_string(topic.port)};
 
     const auto HERE = std::filesystem::path(__FILE__).parent_path();
     const auto output_dir = HERE / "obstacle_datas";
     std::filesystem::create_directories(output_dir);
 
-    ObstacleDataSink sink(output_dir, endpoint);
+    ObstacleDataSink sink(output_dir, topic, ip);
     while (running) {
         sink.loopOnce();
     }
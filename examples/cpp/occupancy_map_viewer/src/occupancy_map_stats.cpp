@@ -2,7 +2,10 @@
 #include <csignal>
 #include <iomanip>
 #include <iostream>
+#include <nodar/zmq/endpoint.hpp>
+#include <nodar/zmq/frame_stats.hpp>
 #include <nodar/zmq/image.hpp>
+#include <nodar/zmq/topic_ports.hpp>
 #include <zmq.hpp>
 
 std::atomic_bool running{true};
@@ -34,7 +37,7 @@ struct OccupancyMapMetadata {
     }
 };
 
-bool parseMetadata(const std::vector<uint8_t> &additional_field, OccupancyMapMetadata &metadata) {
+bool parseMetadata(const nodar::zmq::Span<const uint8_t> &additional_field, OccupancyMapMetadata &metadata) {
     constexpr size_t expected_size = 5 * sizeof(float);  // 5 floats = 20 bytes
     if (additional_field.size() != expected_size) {
         std::cerr << "Warning: Expected " << expected_size << " bytes of metadata, got " << additional_field.size()
@@ -57,7 +60,7 @@ bool parseMetadata(const std::vector<uint8_t> &additional_field, OccupancyMapMet
 }
 
 // Count non-zero bytes in the image data (occupied cells)
-uint32_t countOccupiedCells(const std::vector<uint8_t> &img_data) {
+uint32_t countOccupiedCells(const nodar::zmq::Span<const uint8_t> &img_data) {
     uint32_t count = 0;
     for (const auto &pixel : img_data) {
         if (pixel != 0) {
@@ -109,7 +112,7 @@ std::string getImageType(uint32_t type) {
 
 class OccupancyMapStats {
 public:
-    uint64_t last_frame_id = 0;
+    nodar::zmq::FrameStats frame_stats{nodar::zmq::OCCUPANCY_MAP_TOPIC.name};
 
     OccupancyMapStats(const std::string &endpoint) : context(1), socket(context, ZMQ_SUB) {
         const int hwm = 1;  // set maximum queue length to 1 message
@@ -122,18 +125,17 @@ public:
     void loopOnce() {
         zmq::message_t msg;
         const auto received_bytes = socket.recv(msg, zmq::recv_flags::none);
-        const nodar::zmq::StampedImage stamped_image(static_cast<uint8_t *>(msg.data()));
+        // The view reads the image in place, so it must not outlive msg
+        const nodar::zmq::StampedImageView stamped_image(static_cast<const uint8_t *>(msg.data()), msg.size());
 
         if (stamped_image.empty()) {
             return;
         }
 
         const auto &frame_id = stamped_image.frame_id;
-        if (last_frame_id != 0 && frame_id != last_frame_id + 1) {
-            std::cerr << (frame_id - last_frame_id - 1) << " frames dropped. Current frame ID : " << frame_id
-                      << ", last frame ID: " << last_frame_id << std::endl;
+        if (const auto dropped = frame_stats.record(stamped_image, msg.size())) {
+            std::cerr << dropped << " frames dropped. Current frame ID : " << frame_id << std::endl;
         }
-        last_frame_id = frame_id;
 
         // Parse metadata from additional_field
         OccupancyMapMetadata metadata;
@@ -181,7 +183,7 @@ int main(int argc, char *argv[]) {
         printUsage(default_ip);
     }
     const auto ip{argc > 1 ? argv[1] : default_ip};
-    const auto endpoint{std::string("tcp://") + ip + ":" + std::to_string(occupancy_map_port)};
+    const auto endpoint{nodar::zmq::connectEndpoint(ip, occupancy_map_port)};
 
     OccupancyMapStats viewer(endpoint);
     while (running) {
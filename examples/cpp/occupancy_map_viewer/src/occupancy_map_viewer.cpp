@@ -1,9 +1,15 @@
 #include <atomic>
+#include <chrono>
 #include <csignal>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <nodar/zmq/conflating_subscriber.hpp>
+#include <nodar/zmq/endpoint.hpp>
+#include <nodar/zmq/frame_stats.hpp>
 #include <nodar/zmq/image.hpp>
 #include <nodar/zmq/opencv_utils.hpp>
+#include <nodar/zmq/topic_ports.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 #include <zmq.hpp>
@@ -35,7 +41,7 @@ struct OccupancyMapMetadata {
     }
 };
 
-bool parseMetadata(const std::vector<uint8_t> &additional_field, OccupancyMapMetadata &metadata) {
+bool parseMetadata(const nodar::zmq::Span<const uint8_t> &additional_field, OccupancyMapMetadata &metadata) {
     constexpr size_t expected_size = 5 * sizeof(float);  // 5 floats = 20 bytes
     if (additional_field.size() != expected_size) {
         std::cerr << "Warning: Expected " << expected_size << " bytes of metadata, got " << additional_field.size()
@@ -166,34 +172,31 @@ void drawGridOverlay(cv::Mat &display_img, const cv::Mat &occupancy_map, const O
 
 class OccupancyMapViewer {
 public:
-    uint64_t last_frame_id = 0;
-
-    OccupancyMapViewer(const std::string &endpoint)
-        : context(1), socket(context, ZMQ_SUB), window_name("Occupancy Map") {
-        const int hwm = 1;  // set maximum queue length to 1 message
-        socket.set(zmq::sockopt::rcvhwm, hwm);
-        socket.set(zmq::sockopt::subscribe, "");
-        socket.connect(endpoint);
-        std::cout << "Subscribing to " << endpoint << std::endl;
+    nodar::zmq::FrameStats frame_stats{nodar::zmq::OCCUPANCY_MAP_TOPIC.name};
+
+    // Only ever draw the newest map
+    OccupancyMapViewer(const std::string &endpoint) : latest(endpoint), window_name("Occupancy Map") {
         cv::namedWindow(window_name, cv::WINDOW_NORMAL);
+        reporter.add(frame_stats);
     }
 
     void loopOnce() {
-        zmq::message_t msg;
-        const auto received_bytes = socket.recv(msg, zmq::recv_flags::none);
-        const nodar::zmq::StampedImage stamped_image(static_cast<uint8_t *>(msg.data()));
+        const auto frames = latest.waitForNext();
+        if (not frames) {
+            return;
+        }
+        // The view and the cv::Mat below both reference the frames, instead of copying the map out of them
+        const auto stamped_image = nodar::zmq::viewStampedImage(*frames, frames);
 
-        auto img = nodar::zmq::cvMatFromStampedImage(stamped_image);
+        auto img = nodar::zmq::cvMatViewFromStampedImage(stamped_image);
         if (img.empty()) {
             return;
         }
 
         const auto &frame_id = stamped_image.frame_id;
-        if (last_frame_id != 0 and frame_id != last_frame_id + 1) {
-            std::cerr << (frame_id - last_frame_id - 1) << " frames dropped. Current frame ID : " << frame_id
-                      << ", last frame ID: " << last_frame_id << std::endl;
-        }
-        last_frame_id = frame_id;
+        // Only the newest map is drawn, so skipped frame IDs are expected while drawing is slow.
+        // The reporter counts them.
+        frame_stats.record(stamped_image, stamped_image.msgSize());
 
         // Parse metadata from additional_field
         OccupancyMapMetadata metadata;
@@ -216,9 +219,9 @@ public:
     }
 
 private:
-    zmq::context_t context;
-    zmq::socket_t socket;
+    nodar::zmq::ConflatingSubscriber latest;
     std::string window_name;
+    nodar::zmq::FrameStatsReporter reporter{std::chrono::seconds(10), std::cerr};
 };
 
 void printUsage(const std::string &default_ip) {
@@ -242,7 +245,7 @@ int main(int argc, char *argv[]) {
         printUsage(default_ip);
     }
     const auto ip{argc > 1 ? argv[1] : default_ip};
-    const auto endpoint{std::string("tcp://") + ip + ":" + std::to_string(occupancy_map_port)};
+    const auto endpoint{nodar::zmq::connectEndpoint(ip, occupancy_map_port)};
 
     OccupancyMapViewer viewer(endpoint);
     while (running) {
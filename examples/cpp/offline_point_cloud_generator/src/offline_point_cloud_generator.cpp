@@ -1,7 +1,12 @@
 #include <details_parameters.hpp>
 #include <filesystem>
+#include <iomanip>
 #include <iostream>
+#include <nodar/zmq/bag_reader.hpp>
+#include <nodar/zmq/opencv_utils.hpp>
+#include <nodar/zmq/topic_ports.hpp>
 #include <opencv2/calib3d.hpp>
+#include <sstream>
 #include <vector>
 
 #include "get_files.hpp"
@@ -142,15 +147,66 @@ void processFiles(const std::vector<std::filesystem::path> &files, const std::fi
     }
 }
 
+// Convert every point cloud soup in a bag (see bag_recorder). The soups are read in place from the mapped bag,
+// so there is nothing to load or decode per frame apart from the images themselves.
+void processBag(const nodar::zmq::BagReader &bag, const std::filesystem::path &output_dir,
+                PointCloudWriter &point_cloud_writer) {
+    const auto count = bag.count(nodar::zmq::SOUP_TOPIC);
+    std::cout << "Found " << count << " point cloud soups to convert to point clouds" << std::endl;
+    for (const auto i : tq::trange(count)) {
+        const auto soup = bag.soup(nodar::zmq::SOUP_TOPIC, i);
+        const auto rectified = soup.rectified();
+        const auto disparity = soup.disparity();
+        if (rectified.empty() or disparity.empty()) {
+            continue;
+        }
+
+        DetailsParameters details{};
+        details.leftTime = soup.time;
+        details.focalLength = static_cast<float>(soup.focal_length);
+        details.baseline = static_cast<float>(soup.baseline);
+        details.projection = soup.disparity_to_depth4x4;
+        details.rotationDisparityToRawCam = soup.rotation_disparity_to_raw_cam;
+        details.rotationWorldToRawCam = soup.rotation_world_to_raw_cam;
+
+        // Disparity is in 11.6 format
+        cv::Mat input_image;
+        nodar::zmq::cvMatViewFromStampedImage(disparity).convertTo(input_image, CV_32FC1, 1.0 / 16.0);
+        cv::Mat left_rect = nodar::zmq::cvMatViewFromStampedImage(rectified);
+        if (left_rect.type() == CV_16UC3) {
+            left_rect.convertTo(left_rect, CV_8UC3, 1.0 / 256.0);
+        }
+        if (left_rect.type() != CV_8UC3) {
+            std::cerr << "Skipping frame " << soup.frame_id << ", whose rectified image is not a color image."
+                      << std::endl;
+            continue;
+        }
+
+        std::ostringstream ply_name;
+        ply_name << std::setw(9) << std::setfill('0') << soup.frame_id << ".ply";
+        point_cloud_writer(output_dir / ply_name.str(), details, input_image, left_rect, true);
+    }
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 2) {
         std::cerr << "Expecting at least one argument "
                   << "(the path to the recorded data). Usage:\n\n"
-                  << "\toffline_point_cloud_generator data_directory [output_directory]" << std::endl;
+                  << "\toffline_point_cloud_generator data_directory [output_directory]\n\n"
+                  << "or, for a recording of nodar/point_cloud_soup made with bag_recorder,\n\n"
+                  << "\toffline_point_cloud_generator bag_prefix [output_directory]" << std::endl;
         return EXIT_FAILURE;
     }
     const std::filesystem::path input_dir(argv[1]);
-    const std::filesystem::path output_dir = argc > 2 ? argv[2] : (input_dir / "point_clouds");
+    // A bag is given by the prefix of its segments (see nodar::zmq::bagSegmentPath), or by one of its segments
+    const auto is_bag = input_dir.extension() == ".bag" or
+                        std::filesystem::exists(nodar::zmq::bagSegmentPath(input_dir.string(), 0));
+    std::filesystem::path output_dir = input_dir / "point_clouds";
+    if (argc > 2) {
+        output_dir = argv[2];
+    } else if (is_bag) {
+        output_dir = std::filesystem::path(input_dir).replace_extension().string() + "_point_clouds";
+    }
 
     // Directories that we read
 
@@ -179,7 +235,13 @@ int main(int argc, char *argv[]) {
     std::filesystem::create_directories(output_dir);
 
     PointCloudWriter point_cloud_writer;
-    if (std::filesystem::exists(disparity_dir)) {
+    if (is_bag) {
+        const nodar::zmq::BagReader bag(input_dir.string());
+        if (bag.empty()) {
+            return EXIT_FAILURE;
+        }
+        processBag(bag, output_dir, point_cloud_writer);
+    } else if (std::filesystem::exists(disparity_dir)) {
         const auto disparities = getFiles(disparity_dir, ".tiff");
         std::cout << "Found " << disparities.size() << " disparity maps to convert to point clouds" << std::endl;
         processFiles(disparities, left_rect_dir, details_dir, output_dir, point_cloud_writer, true);
@@ -2,10 +2,11 @@
 
 #include <fstream>
 #include <nodar/zmq/point_cloud.hpp>
-#include <vector>
+#include <nodar/zmq/span.hpp>
 
 template <typename String>
-inline void writePly(const String &filename, const std::vector<nodar::zmq::Point> &point_cloud, bool ascii = false) {
+inline void writePly(const String &filename, nodar::zmq::Span<const nodar::zmq::Point> point_cloud,
+                     bool ascii = false) {
     std::ofstream out(filename, std::ios::binary);
     out << "ply\n";
     if (ascii) {
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cassert>
 #include <fstream>
+#include <nodar/zmq/point_cloud.hpp>
+#include <nodar/zmq/span.hpp>
 #include <vector>
 
 struct PointXYZRGB {
@@ -13,8 +16,8 @@ struct PointXYZRGB {
 };
 
 template <typename String>
-inline void writePly(const String &filename, const std::vector<nodar::zmq::Point> &points,
-                     const std::vector<nodar::zmq::Point> &colors, bool ascii = false) {
+inline void writePly(const String &filename, nodar::zmq::Span<const nodar::zmq::Point> points,
+                     nodar::zmq::Span<const nodar::zmq::Point> colors, bool ascii = false) {
     assert(points.size() == colors.size() && "points and colors must be the same size");
 
     std::vector<PointXYZRGB> point_cloud;
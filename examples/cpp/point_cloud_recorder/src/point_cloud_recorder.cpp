@@ -2,6 +2,8 @@
 #include <csignal>
 #include <filesystem>
 #include <iostream>
+#include <nodar/zmq/endpoint.hpp>
+#include <nodar/zmq/frame_stats.hpp>
 #include <nodar/zmq/point_cloud.hpp>
 #include <nodar/zmq/topic_ports.hpp>
 #include <zmq.hpp>
@@ -17,7 +19,7 @@ void signalHandler(int signum) {
 
 class PointCloudSink {
 public:
-    uint64_t last_frame_id = 0;
+    nodar::zmq::FrameStats frame_stats{nodar::zmq::POINT_CLOUD_TOPIC.name};
 
     PointCloudSink(const std::filesystem::path &output_dir, const std::string &endpoint)
         : output_dir(output_dir), context(1), socket(context, ZMQ_SUB) {
@@ -31,7 +33,8 @@ public:
     void loopOnce() {
         zmq::message_t msg;
         const auto received_bytes = socket.recv(msg, zmq::recv_flags::none);
-        point_cloud.read(static_cast<uint8_t *>(msg.data()));
+        // The view reads the points in place, so it must not outlive msg
+        const nodar::zmq::PointCloudView point_cloud(static_cast<const uint8_t *>(msg.data()), msg.size());
 
         // If the point_cloud was not received correctly, return
         if (point_cloud.empty()) {
@@ -40,11 +43,9 @@ public:
 
         // Warn if we dropped a frame
         const auto &frame_id = point_cloud.frame_id;
-        if (last_frame_id != 0 and frame_id != last_frame_id + 1) {
-            std::cerr << (frame_id - last_frame_id - 1) << " frames dropped. Current frame ID : " << frame_id
-                      << ", last frame ID: " << last_frame_id << std::endl;
+        if (const auto dropped = frame_stats.record(point_cloud, msg.size())) {
+            std::cerr << dropped << " frames dropped. Current frame ID : " << frame_id << std::endl;
         }
-        last_frame_id = frame_id;
         std::cout << "\rFrame # " << frame_id << ". " << std::flush;
 
         std::ostringstream filename_ss;
@@ -56,7 +57,6 @@ public:
 
 private:
     std::filesystem::path output_dir;
-    nodar::zmq::PointCloud point_cloud;
     zmq::context_t context;
     zmq::socket_t socket;
 };
@@ -80,7 +80,7 @@ int main(int argc, char *argv[]) {
         printUsage(default_ip);
     }
     const auto ip = argc > 1 ? argv[1] : default_ip;
-    const auto endpoint = std::string("tcp://") + ip + ":" + std::to_string(topic.port);
+    const auto endpoint = nodar::zmq::connectEndpoint(ip, topic);
 
     const auto HERE = std::filesystem::path(__FILE__).parent_path();
     const auto output_dir = HERE / "point_clouds";
@@ -4,12 +4,17 @@
 #include <filesystem>
 #include <iostream>
 #include <memory>
+#include <nodar/zmq/endpoint.hpp>
+#include <nodar/zmq/frame_stats.hpp>
+#include <nodar/zmq/multipart.hpp>
 #include <nodar/zmq/opencv_utils.hpp>
 #include <nodar/zmq/point_cloud_soup.hpp>
+#include <nodar/zmq/shared_memory.hpp>
 #include <nodar/zmq/topic_ports.hpp>
 #include <opencv2/calib3d.hpp>
 #include <string>
 #include <thread>
+#include <vector>
 #include <zmq.hpp>
 
 #include "ply.hpp"
@@ -24,16 +29,25 @@ void signalHandler(int signum) {
 
 class PointCloudSink {
 public:
-    uint64_t last_frame_id = 0;
+    nodar::zmq::FrameStats frame_stats{nodar::zmq::SOUP_TOPIC.name};
 
-    PointCloudSink(const std::filesystem::path &output_dir, const std::string &endpoint,
+    PointCloudSink(const std::filesystem::path &output_dir, const std::string &ip,
                    const std::string &scheduler_endpoint, bool enable_scheduler)
-        : output_dir(output_dir), context(1), socket(context, ZMQ_SUB), enable_scheduler(enable_scheduler) {
-        const int hwm = 1;  // set maximum queue length to 1 message
-        socket.set(zmq::sockopt::rcvhwm, hwm);
-        socket.set(zmq::sockopt::subscribe, "");
-        socket.connect(endpoint);
-        std::cout << "Subscribing to " << endpoint << std::endl;
+        : output_dir(output_dir), context(1), enable_scheduler(enable_scheduler) {
+        static constexpr auto topic = nodar::zmq::SOUP_TOPIC;
+        // Hammerhead may serve the soups to this host over shared memory, which saves copying them through a socket
+        if (nodar::zmq::sharedMemoryAvailable(ip, topic.port)) {
+            // Read the soups in place from the shared memory ring of the publisher (see shared_memory.hpp)
+            shared_memory.reset(new nodar::zmq::SharedMemorySubscriber(context, topic.port));
+        } else {
+            const auto endpoint = nodar::zmq::connectEndpoint(ip, topic);
+            socket = std::make_unique<zmq::socket_t>(context, ZMQ_SUB);
+            const int hwm = 1;  // set maximum queue length to 1 message
+            socket->set(zmq::sockopt::rcvhwm, hwm);
+            socket->set(zmq::sockopt::subscribe, "");
+            socket->connect(endpoint);
+            std::cout << "Subscribing to " << endpoint << std::endl;
+        }
 
         // Connect to scheduler (wait server) if enabled
         if (enable_scheduler) {
@@ -44,27 +58,41 @@ public:
     }
 
     void loopOnce() {
-        zmq::message_t msg;
-        const auto received_bytes = socket.recv(msg, zmq::recv_flags::none);
-        const nodar::zmq::PointCloudSoup soup(static_cast<uint8_t *>(msg.data()));
+        nodar::zmq::SharedMemoryMessage shared;
+        nodar::zmq::PointCloudSoupView soup;
+        if (shared_memory) {
+            shared = shared_memory->recv();
+            // Nothing was received, or the slot was already reused, which the subscriber counts in overwritten()
+            if (shared.empty()) {
+                return;
+            }
+            soup = nodar::zmq::PointCloudSoupView(shared.data.data(), shared.data.size(), shared.owner);
+        } else {
+            // Soups may arrive as a single frame, or as multiple frames (see nodar/zmq/multipart.hpp)
+            if (not nodar::zmq::recvFrames(*socket, frames)) {
+                return;
+            }
+            // The views read the soup in place, so they must not outlive the frames
+            soup = nodar::zmq::viewPointCloudSoup(frames);
+        }
+        const auto rectified = soup.rectified();
+        const auto disparity = soup.disparity();
 
         // If the soup was not received correctly, return
-        if (soup.empty()) {
+        if (rectified.empty() or disparity.empty()) {
             return;
         }
 
         // Warn if we dropped a frame
         const auto &frame_id = soup.frame_id;
-        if (last_frame_id != 0 and frame_id != last_frame_id + 1) {
-            std::cerr << (frame_id - last_frame_id - 1) << " frames dropped. Current frame ID : " << frame_id
-                      << ", last frame ID: " << last_frame_id << std::endl;
+        if (const auto dropped = frame_stats.record(soup, shared_memory ? shared.data.size() : framesSize())) {
+            std::cerr << dropped << " frames dropped. Current frame ID : " << frame_id << std::endl;
         }
-        last_frame_id = frame_id;
         std::cout << "\rFrame # " << frame_id << ". " << std::endl;
 
         // Allocate space for the point cloud
-        const auto rows = soup.disparity.rows;
-        const auto cols = soup.disparity.cols;
+        const auto rows = disparity.rows;
+        const auto cols = disparity.cols;
         point_cloud.resize(rows * cols);
 
         // Disparity is in 11.6 format
@@ -90,18 +118,18 @@ public:
         // Negate the last row of the Q-matrix
         disparity_to_rotated_depth4x4.row(3) = -disparity_to_rotated_depth4x4.row(3);
 
-        auto disparity_scaled = nodar::zmq::cvMatFromStampedImage(soup.disparity);
-        disparity_scaled.convertTo(disparity_scaled, CV_32F, 1. / 16);
+        cv::Mat disparity_scaled;
+        nodar::zmq::cvMatViewFromStampedImage(disparity).convertTo(disparity_scaled, CV_32F, 1. / 16);
         cv::reprojectImageTo3D(disparity_scaled, depth3d, disparity_to_rotated_depth4x4);
 
         // Assert types before continuing
         assert(depth3d.type() == CV_32FC3);
-        const auto rect_type = soup.rectified.type;
+        const auto rect_type = rectified.type;
         assert(rect_type == CV_8UC3 or rect_type == CV_8SC3 or rect_type == CV_16UC3 or rect_type == CV_16SC3);
 
         auto xyz = reinterpret_cast<float *>(depth3d.data);
         const auto bgr_step = rect_type == CV_8UC3 or rect_type == CV_8SC3 ? 3 : 6;
-        auto bgr = soup.rectified.img.data();
+        auto bgr = rectified.img.data();
         size_t total = 0;
         size_t valid = 0;
         const auto downsample = 10;
@@ -139,8 +167,13 @@ public:
         std::ostringstream filename_ss;
         filename_ss << std::setw(9) << std::setfill('0') << frame_id << ".ply";
         const auto filename = output_dir / filename_ss.str();
-        std::cout << "Writing " << filename << std::endl;
-        writePly(filename, point_cloud);
+        if (shared_memory and not shared.valid()) {
+            // The publisher reused the slot while we were reading it, so the point cloud may be torn
+            std::cerr << "Frame " << frame_id << " was overwritten while it was being read. Skipping it." << std::endl;
+        } else {
+            std::cout << "Writing " << filename << std::endl;
+            writePly(filename, point_cloud);
+        }
 
         // Wait for scheduler request from hammerhead, then send reply (if enabled)
         if (enable_scheduler && scheduler_socket) {
@@ -155,6 +188,14 @@ public:
     }
 
 private:
+    size_t framesSize() const {
+        size_t size = 0;
+        for (const auto &frame : frames) {
+            size += frame.size();
+        }
+        return size;
+    }
+
     static bool isValid(const float *const xyz) {
         return not std::isinf(xyz[0]) and not std::isinf(xyz[1]) and not std::isinf(xyz[2]);
     }
@@ -163,7 +204,11 @@ private:
     cv::Mat depth3d;
     std::vector<PointXYZRGB> point_cloud;
     zmq::context_t context;
-    zmq::socket_t socket;
+    // Exactly one of these is set
+    std::unique_ptr<zmq::socket_t> socket;
+    // The frames of the last soup that was received over the socket, reused from one soup to the next
+    std::vector<zmq::message_t> frames;
+    std::unique_ptr<nodar::zmq::SharedMemorySubscriber> shared_memory;
     std::unique_ptr<zmq::socket_t> scheduler_socket;
     bool enable_scheduler;
 };
@@ -187,7 +232,6 @@ void printUsage(const std::string &default_ip) {
 
 int main(int argc, char *argv[]) {
     static constexpr auto default_ip = "127.0.0.1";
-    static constexpr auto topic = nodar::zmq::SOUP_TOPIC;
     static constexpr auto wait_topic = nodar::zmq::WAIT_TOPIC;
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
@@ -229,11 +273,10 @@ int main(int argc, char *argv[]) {
         output_dir = HERE / "point_clouds";
     }
 
-    const auto endpoint = std::string("tcp://") + ip + ":" + std::to_string(topic.port);
     const auto scheduler_endpoint = std::string("tcp://") + ip + ":" + std::to_string(wait_topic.port);
     std::filesystem::create_directories(output_dir);
 
-    PointCloudSink sink(output_dir, endpoint, scheduler_endpoint, enable_scheduler);
+    PointCloudSink sink(output_dir, ip, scheduler_endpoint, enable_scheduler);
     while (running) {
         sink.loopOnce();
     }
@@ -1,10 +1,12 @@
 #include <atomic>
+#include <chrono>
 #include <csignal>
 #include <iomanip>
 #include <iostream>
+#include <nodar/zmq/conflating_subscriber.hpp>
+#include <nodar/zmq/frame_stats.hpp>
 #include <nodar/zmq/qa_findings.hpp>
 #include <nodar/zmq/topic_ports.hpp>
-#include <zmq.hpp>
 
 std::atomic_bool running{true};
 
@@ -15,28 +17,20 @@ void signalHandler(int signum) {
 
 class QAFindingsViewer {
 public:
-    uint64_t last_frame_id = 0;
-
-    QAFindingsViewer(const std::string& endpoint) : context(1), socket(context, ZMQ_SUB) {
-        const int hwm = 1;  // set maximum queue length to 1 message
-        socket.set(zmq::sockopt::rcvhwm, hwm);
-        socket.set(zmq::sockopt::subscribe, "");
-        socket.connect(endpoint);
-        std::cout << "Subscribing to " << endpoint << std::endl;
+    nodar::zmq::FrameStats frame_stats{nodar::zmq::QA_FINDINGS_TOPIC.name};
+
+    QAFindingsViewer(const nodar::zmq::Topic& topic, const std::string& ip) : subscriber(topic, ip) {
+        // Reports that arrive while one is being printed are skipped, so the gaps are summed up periodically instead
+        reporter.add(frame_stats);
     }
 
     void loopOnce() {
-        zmq::message_t msg;
-        const auto received_bytes = socket.recv(msg, zmq::recv_flags::none);
-        const nodar::zmq::QAFindings qa_msg(static_cast<const uint8_t*>(msg.data()));
-
-        // Warn if we dropped a frame
-        const auto& frame_id = qa_msg.frame_id;
-        if (last_frame_id != 0 && frame_id != last_frame_id + 1) {
-            std::cerr << (frame_id - last_frame_id - 1) << " frames dropped. Current frame ID : " << frame_id
-                      << ", last frame ID: " << last_frame_id << std::endl;
+        // Only decode the newest report
+        if (not subscriber.decodeNext(qa_msg)) {
+            return;
         }
-        last_frame_id = frame_id;
+
+        frame_stats.record(qa_msg, qa_msg.msgSize());
         std::cout << "\nQA FINDINGS REPORT" << std::endl;
         std::cout << "Time: " << qa_msg.time << " ns" << std::endl;
         std::cout << "Frame ID: " << qa_msg.frame_id << std::endl;
@@ -116,8 +110,9 @@ public:
         std::cout << std::endl;
     }
 
-    zmq::context_t context;
-    zmq::socket_t socket;
+    nodar::zmq::ConflatingSubscriber subscriber;
+    nodar::zmq::FrameStatsReporter reporter{std::chrono::seconds(10), std::cerr};
+    nodar::zmq::QAFindings qa_msg;
 };
 
 void printUsage(const std::string& default_ip) {
@@ -139,9 +134,8 @@ int main(int argc, char* argv[]) {
         printUsage(default_ip);
     }
     const auto ip = argc > 1 ? argv[1] : default_ip;
-    const auto endpoint = std::string("tcp://") + ip + ":" + std::to_string(topic.port);
 
-    QAFindingsViewer viewer(endpoint);
+    QAFindingsViewer viewer(topic, ip);
     while (running) {
         viewer.loopOnce();
     }
@@ -3,8 +3,10 @@
 #include <filesystem>
 #include <iostream>
 #include <nodar/zmq/image.hpp>
+#include <nodar/zmq/multipart.hpp>
 #include <nodar/zmq/opencv_utils.hpp>
 #include <nodar/zmq/publisher.hpp>
+#include <nodar/zmq/shared_memory.hpp>
 #include <opencv2/core.hpp>
 #include <string>
 
@@ -13,7 +15,23 @@ namespace zmq {
 
 class TopbotPublisher {
 public:
-    explicit TopbotPublisher(const uint16_t& port) : publisher(Topic{"external/topbot_raw", port}, "") {
+    /**
+     * If multipart is true, then each image is sent as a header frame followed by a frame that points straight at the
+     * pixels of the cv::Mat, instead of being serialized into one contiguous buffer first (see multipart.hpp).
+     * Only enable this if the receiver reads multipart messages.
+     *
+     * If shared_memory is true, then each image is written into a shared memory ring,
+     * which receivers on this host can read in place (see shared_memory.hpp).
+     * Receivers on other hosts still get the regular single-part messages. This takes precedence over multipart.
+     */
+    explicit TopbotPublisher(const uint16_t& port, bool multipart = false, bool shared_memory = false)
+        : multipart(multipart) {
+        const Topic topic{"external/topbot_raw", port};
+        if (shared_memory) {
+            shared_publisher.reset(new SharedMemoryPublisher<StampedImage>(topic));
+        } else {
+            publisher.reset(new Publisher<StampedImage>(topic, ""));
+        }
         std::this_thread::sleep_for(std::chrono::seconds(1));
     }
 
@@ -28,16 +46,41 @@ public:
             return false;
         }
 
-        auto buffer = publisher.getBuffer();
-        buffer->resize(nodar::zmq::StampedImage::msgSize(img.rows, img.cols, img.type(), 0));
-        nodar::zmq::StampedImage::write(buffer->data(), timestamp, frame_id, img.rows, img.cols, img.type(),
-                                        cvt_to_bgr_code, img.data, 0);
-        publisher.send(buffer);
+        if (shared_publisher) {
+            // Write the header straight into a slot of the ring, and then copy the pixels in behind it
+            auto loan = shared_publisher->emplace(StampedImage::msgSize(img.rows, img.cols, img.type(), 0),  //
+                                                  timestamp, frame_id, img.rows, img.cols, img.type(), cvt_to_bgr_code,
+                                                  0);
+            img.copyTo(cv::Mat(img.rows, img.cols, img.type(), loan.payload()));
+            loan.send();
+            return true;
+        }
+
+        if (multipart and img.isContinuous()) {
+            const auto header = multipart::writeStampedImageHeader(publisher->getBuffer(), timestamp, frame_id,
+                                                                   img.rows, img.cols, img.type(), cvt_to_bgr_code, 0);
+            // cv::Mat is reference counted, so a heap-allocated copy of the header keeps the pixels alive until ZMQ
+            // releases the frame.
+            const auto pixels = new cv::Mat(img);
+            const Frame image_data(pixels->data, pixels->total() * pixels->elemSize(),
+                                   [](void*, void* hint) { delete static_cast<cv::Mat*>(hint); }, pixels);
+            publisher->send({header, image_data});
+            return true;
+        }
+
+        // Write the header straight into the outgoing buffer, and then copy the pixels in behind it
+        auto loan = publisher->emplace(StampedImage::msgSize(img.rows, img.cols, img.type(), 0),  //
+                                       timestamp, frame_id, img.rows, img.cols, img.type(), cvt_to_bgr_code, 0);
+        img.copyTo(cv::Mat(img.rows, img.cols, img.type(), loan.payload()));
+        loan.send();
         return true;
     }
 
 private:
-    nodar::zmq::Publisher<nodar::zmq::StampedImage> publisher;
+    bool multipart;
+    // Exactly one of these is set
+    std::unique_ptr<nodar::zmq::Publisher<nodar::zmq::StampedImage>> publisher;
+    std::unique_ptr<nodar::zmq::SharedMemoryPublisher<nodar::zmq::StampedImage>> shared_publisher;
 };
 
 }  // namespace zmq
@@ -56,8 +56,25 @@ int main(int argc, char* argv[]) {
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
 
+    // Send each image as a multipart message, so that the pixels do not need to be copied into a buffer first,
+    // or write each image into a shared memory ring, so that receivers on this host can read it in place
+    bool multipart = false;
+    bool shared_memory = false;
+    for (; argc > 1; --argc) {
+        const std::string flag = argv[argc - 1];
+        if (flag == "--multipart") {
+            multipart = true;
+        } else if (flag == "--shared-memory") {
+            shared_memory = true;
+        } else {
+            break;
+        }
+    }
+
     if (argc < 3 || argc > 4) {
-        std::cerr << "Usage: topbot_publisher <topbot_data_directory> <port_number> [pixel_format]" << std::endl;
+        std::cerr << "Usage: topbot_publisher <topbot_data_directory> <port_number> [pixel_format] [--multipart] "
+                     "[--shared-memory]"
+                  << std::endl;
         std::cerr << "Supported pixel formats: BGR, Bayer_RGGB, Bayer_GRBG, Bayer_BGGR, Bayer_GBRG" << std::endl;
         return EXIT_FAILURE;
     }
@@ -97,7 +114,7 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
 
-    nodar::zmq::TopbotPublisher publisher(port);
+    nodar::zmq::TopbotPublisher publisher(port, multipart, shared_memory);
     auto frame_id = 0;
 
     for (const auto& file : image_files) {
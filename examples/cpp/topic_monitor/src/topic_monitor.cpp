@@ -0,0 +1,127 @@
+#include <atomic>
+#include <csignal>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <nodar/zmq/clock_sync.hpp>
+#include <nodar/zmq/frame_stats.hpp>
+#include <nodar/zmq/image.hpp>
+#include <nodar/zmq/obstacle_data.hpp>
+#include <nodar/zmq/qa_findings.hpp>
+#include <nodar/zmq/topic_loop.hpp>
+#include <nodar/zmq/topic_ports.hpp>
+#include <string>
+#include <vector>
+
+std::atomic_bool running{true};
+
+void signalHandler(int signum) {
+    std::cerr << "SIGINT or SIGTERM received." << std::endl;
+    running = false;
+}
+
+class TopicMonitor {
+public:
+    TopicMonitor(const std::string& ip_arg, bool multiplexed_arg)
+        : ip(ip_arg), multiplexed(multiplexed_arg), clock(ip) {
+        // Every handler runs on the thread that runs the loop, so none of them need any locking.
+        // Only the headers of the images are needed, so they are viewed in place rather than copied out.
+        auto& left = addStats(nodar::zmq::LEFT_RECT_TOPIC);
+        subscribe<nodar::zmq::StampedImageView>(nodar::zmq::LEFT_RECT_TOPIC,
+                                                [&left](const auto& image) { left.record(image, image.msgSize()); });
+        auto& disparity = addStats(nodar::zmq::DISPARITY_TOPIC);
+        subscribe<nodar::zmq::StampedImageView>(nodar::zmq::DISPARITY_TOPIC, [&disparity](const auto& image) {
+            disparity.record(image, image.msgSize());
+        });
+        auto& obstacle = addStats(nodar::zmq::OBSTACLE_TOPIC);
+        subscribe<nodar::zmq::ObstacleData>(nodar::zmq::OBSTACLE_TOPIC, [&obstacle](const auto& obstacles) {
+            obstacle.record(obstacles, obstacles.msgSize());
+        });
+        auto& qa = addStats(nodar::zmq::QA_FINDINGS_TOPIC);
+        subscribe<nodar::zmq::QAFindings>(nodar::zmq::QA_FINDINGS_TOPIC, [&qa](const auto& findings) {
+            qa.record(findings, findings.msgSize());
+            for (const auto& finding : findings.findings) {
+                if (finding.severity == nodar::zmq::QAFindings::Severity::ERROR) {
+                    std::cerr << "[ERROR] " << finding.domain << "::" << finding.key << ": " << finding.message
+                              << std::endl;
+                }
+            }
+        });
+        loop.addTimer(std::chrono::seconds(1), [this] { report(); });
+    }
+
+    void run() { loop.run(running); }
+
+private:
+    // What we have seen of one topic, and its summary at the time of the last report
+    struct Monitored {
+        nodar::zmq::FrameStats stats;
+        nodar::zmq::FrameStats::Summary reported;
+
+        explicit Monitored(const nodar::zmq::Topic& topic) : stats(topic.name), reported(stats.summary()) {}
+    };
+
+    const std::string ip;
+    // Whether to receive all the topics over one connection to the multiplexed port of the device
+    const bool multiplexed;
+    // Converts the time stamps of the device to our clock, so that the latencies are right even across hosts
+    nodar::zmq::ClockSyncClient clock;
+    nodar::zmq::TopicLoop loop;
+    std::vector<std::unique_ptr<Monitored>> topics;
+
+    template <typename Data>
+    void subscribe(const nodar::zmq::Topic& topic, std::function<void(const Data&)> handler) {
+        if (multiplexed) {
+            loop.subscribeMultiplexed<Data>(topic, ip, std::move(handler));
+        } else {
+            loop.subscribe<Data>(topic, ip, std::move(handler));
+        }
+    }
+
+    nodar::zmq::FrameStats& addStats(const nodar::zmq::Topic& topic) {
+        topics.emplace_back(new Monitored(topic));
+        topics.back()->stats.setClockOffset(clock.offset());
+        return topics.back()->stats;
+    }
+
+    // Print what happened on each topic since the last report
+    void report() {
+        std::cout << std::string(60, '-') << std::endl;
+        if (clock.synchronized()) {
+            std::cout << "Clock offset " << clock.offset() / 1000 << " us (+/- " << clock.delay() / 2000 << " us)"
+                      << std::endl;
+        }
+        for (auto& topic : topics) {
+            auto summary = topic->stats.summary();
+            (summary - topic->reported).print(std::cout);
+            topic->reported = std::move(summary);
+        }
+    }
+};
+
+void printUsage(const std::string& default_ip) {
+    std::cout << "You should specify the IP address of the device running hammerhead:\n\n"
+                 "     ./topic_monitor hammerhead_ip [--multiplexed]\n\n"
+                 "e.g. ./topic_monitor 10.10.1.10\n\n"
+                 "In the meantime, we assume that you are running this on the device running Hammerhead:\n\n"
+                 "     ./topic_monitor "
+              << default_ip << "\n"
+              << "\n----------------------------------------" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    static constexpr auto default_ip = "127.0.0.1";
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+    const auto multiplexed = argc > 1 and std::string(argv[argc - 1]) == "--multiplexed";
+    if (multiplexed) {
+        --argc;
+    }
+    if (argc == 1) {
+        printUsage(default_ip);
+    }
+    const auto ip = argc > 1 ? argv[1] : default_ip;
+
+    TopicMonitor monitor(ip, multiplexed);
+    monitor.run();
+}
@@ -0,0 +1,107 @@
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <nodar/zmq/last_value_cache.hpp>
+#include <nodar/zmq/relay.hpp>
+#include <nodar/zmq/topic_ports.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+std::atomic_bool running{true};
+
+void signalHandler(int signum) {
+    std::cerr << "SIGINT or SIGTERM received." << std::endl;
+    running = false;
+}
+
+void printUsage(const std::string& default_ip) {
+    std::cout << "You should specify the IP address of the device running hammerhead:\n\n"
+                 "     ./topic_relay hammerhead_ip [--local-only] [--port-offset offset]\n\n"
+                 "e.g. ./topic_relay 10.10.1.10\n\n"
+                 "In the meantime, we assume that you are running this on the device running Hammerhead:\n\n"
+                 "     ./topic_relay "
+              << default_ip << " --port-offset 1000\n"
+              << "\n----------------------------------------" << std::endl;
+}
+
+void printStats(const std::vector<nodar::zmq::Topic>& topics, const std::vector<nodar::zmq::RelayStats>& stats,
+                const std::vector<nodar::zmq::RelayStats>& previous) {
+    for (size_t i = 0; i < topics.size(); ++i) {
+        if (not stats[i].subscribed and stats[i].received == previous[i].received) {
+            continue;
+        }
+        std::cout << topics[i].name << ": relayed " << stats[i].received - previous[i].received << " messages";
+        if (stats[i].replayed != previous[i].replayed) {
+            std::cout << ", replayed the last one " << stats[i].replayed - previous[i].replayed << " times";
+        }
+        std::cout << (stats[i].subscribed ? "" : " (no subscribers)") << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    static constexpr auto default_ip = "127.0.0.1";
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+
+    // Only re-publish on ipc (and inproc), for subscribers on this host,
+    // and/or move the relayed topics to other ports, e.g. when the relay runs on the device itself
+    bool local_only = false;
+    uint16_t port_offset = 0;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--local-only") {
+            local_only = true;
+        } else if (arg == "--port-offset" and i + 1 < argc) {
+            try {
+                port_offset = static_cast<uint16_t>(std::stoul(argv[++i]));
+            } catch (const std::exception& e) {
+                std::cerr << "Invalid port offset: " << e.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (args.empty()) {
+        printUsage(default_ip);
+        port_offset = port_offset ? port_offset : 1000;
+    }
+    const auto ip = args.empty() ? default_ip : args.front();
+
+    // The topics that describe a state, whose last message is sent to every subscriber as soon as it subscribes
+    const std::vector<nodar::zmq::Topic> state_topics{nodar::zmq::OCCUPANCY_MAP_TOPIC, nodar::zmq::QA_FINDINGS_TOPIC};
+    // Every other topic that Hammerhead publishes. These are only pulled from the device while somebody subscribes to
+    // them, so relaying the topics that nobody uses costs nothing.
+    std::vector<nodar::zmq::Topic> topics;
+    for (const auto& topic : nodar::zmq::IMAGE_TOPICS) {
+        if (topic.port != nodar::zmq::OCCUPANCY_MAP_TOPIC.port) {
+            topics.push_back(topic);
+        }
+    }
+    topics.push_back(nodar::zmq::SOUP_TOPIC);
+    topics.push_back(nodar::zmq::POINT_CLOUD_TOPIC);
+    topics.push_back(nodar::zmq::POINT_CLOUD_RGB_TOPIC);
+    topics.push_back(nodar::zmq::OBSTACLE_TOPIC);
+
+    nodar::zmq::Relay relay(topics, ip, 1, port_offset, local_only);
+    nodar::zmq::LastValueCache cache(state_topics, ip, 1, port_offset, local_only);
+
+    // Print how many messages were relayed on each of the topics that somebody subscribes to
+    auto previous = relay.stats();
+    auto previous_state = cache.stats();
+    while (running) {
+        for (int i = 0; i < 50 and running; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        const auto stats = relay.stats();
+        const auto state_stats = cache.stats();
+        std::cout << std::string(60, '-') << std::endl;
+        printStats(topics, stats, previous);
+        printStats(state_topics, state_stats, previous_state);
+        previous = stats;
+        previous_state = state_stats;
+    }
+}
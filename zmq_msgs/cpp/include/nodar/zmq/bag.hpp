@@ -0,0 +1,374 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <nodar/zmq/topic_ports.hpp>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "image.hpp"
+#include "message_info.hpp"
+#include "obstacle_data.hpp"
+#include "point_cloud.hpp"
+#include "point_cloud_rgb.hpp"
+#include "point_cloud_soup.hpp"
+#include "span.hpp"
+#include "utils.hpp"
+
+namespace nodar {
+namespace zmq {
+
+/**
+ * The layout of a bag, i.e. a recording of the raw messages of any number of topics.
+ *
+ * A bag is a sequence of segment files, prefix_000000.bag, prefix_000001.bag, ... (see bagSegmentPath).
+ * Every segment is self-contained, and consists of
+ * - a BagSegmentHeader,
+ * - records, each of which is a BagRecordHeader followed by its payload, padded to BAG_ALIGNMENT bytes:
+ *   - a TOPIC record, with a BagTopicEntry, before the first message of every topic in the segment, and
+ *   - a MESSAGE record, with a message exactly as it was received (MessageInfo header and all),
+ * - the index, i.e. a BagIndexEntry for every message, in the order in which they were written,
+ * - the topic table, i.e. the BagTopicEntry of every topic in the segment, and
+ * - a BagFooter, which says where the index and the topic table start.
+ *
+ * So a reader only needs the footer and the index to find any message, without reading the messages in between.
+ * The topic records are only needed to recover a segment whose index was never written (e.g. after a crash).
+ * Every record starts at a multiple of BAG_ALIGNMENT bytes, so that the messages can be viewed in place.
+ * All the fields are in the byte order of the host, like the messages themselves.
+ */
+constexpr uint32_t BAG_VERSION = 1;
+constexpr uint64_t BAG_ALIGNMENT = 8;
+constexpr char BAG_SEGMENT_MAGIC[8] = {'N', 'O', 'D', 'A', 'R', 'B', 'A', 'G'};
+constexpr char BAG_FOOTER_MAGIC[8] = {'N', 'O', 'D', 'A', 'R', 'I', 'D', 'X'};
+
+struct BagSegmentHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t segment;  // The number of the segment in the bag, starting at 0
+};
+
+struct BagRecordHeader {
+    static constexpr uint16_t TOPIC = 1;
+    static constexpr uint16_t MESSAGE = 2;
+
+    uint16_t kind;
+    uint16_t topic;  // The ID of the topic of the message, or the ID that a topic record introduces
+    uint32_t reserved;
+    uint64_t size;  // The size of the payload, without the padding
+};
+
+// The payload of a topic record, and an entry of the topic table, which is followed by name_size characters,
+// and padded to BAG_ALIGNMENT bytes
+struct BagTopicEntry {
+    uint16_t id;
+    uint16_t port;
+    uint32_t name_size;
+};
+
+struct BagIndexEntry {
+    uint16_t topic;
+    uint16_t reserved;
+    uint32_t reserved2;
+    uint64_t frame_id;
+    uint64_t time;
+    uint64_t offset;  // Where the message starts in the segment (after its record header)
+    uint64_t size;
+};
+
+struct BagFooter {
+    uint64_t index_offset;
+    uint64_t index_size;  // The number of BagIndexEntry in the index
+    uint64_t topics_offset;
+    uint64_t topics_size;  // The number of BagTopicEntry in the topic table
+    char magic[8];
+};
+
+static_assert(sizeof(BagSegmentHeader) == 16 and std::is_trivially_copyable<BagSegmentHeader>::value,
+              "BagSegmentHeader must be packed");
+static_assert(sizeof(BagRecordHeader) == 16 and std::is_trivially_copyable<BagRecordHeader>::value,
+              "BagRecordHeader must be packed");
+static_assert(sizeof(BagTopicEntry) == 8 and std::is_trivially_copyable<BagTopicEntry>::value,
+              "BagTopicEntry must be packed");
+static_assert(sizeof(BagIndexEntry) == 40 and std::is_trivially_copyable<BagIndexEntry>::value,
+              "BagIndexEntry must be packed");
+static_assert(sizeof(BagFooter) == 40 and std::is_trivially_copyable<BagFooter>::value, "BagFooter must be packed");
+
+// The path of a segment of the bag with the given prefix, e.g. recording_000003.bag
+inline std::string bagSegmentPath(const std::string &prefix, uint32_t segment) {
+    std::ostringstream path;
+    path << prefix << "_" << std::setw(6) << std::setfill('0') << segment << ".bag";
+    return path.str();
+}
+
+inline uint64_t bagPadding(uint64_t size) { return (BAG_ALIGNMENT - size % BAG_ALIGNMENT) % BAG_ALIGNMENT; }
+
+/**
+ * Read the time and frame_id of a message, for the message types that start with a MessageInfo, the time,
+ * and the frame_id, i.e. StampedImage, PointCloudSoup, PointCloud, PointCloudRGB and ObstacleData.
+ * Returns false for any other message, or if the message is too small.
+ */
+inline bool readMessageStamp(const uint8_t *data, size_t size, uint64_t &time, uint64_t &frame_id) {
+    MessageInfo info;
+    if (size < sizeof(info) + sizeof(time) + sizeof(frame_id)) {
+        return false;
+    }
+    data = utils::read(data, info);
+    if (info != StampedImage::getInfo() and info != PointCloudSoup::getInfo() and info != PointCloud::getInfo() and
+        info != PointCloudRGB::getInfo() and info != ObstacleData::getInfo()) {
+        return false;
+    }
+    data = utils::read(data, time);
+    utils::read(data, frame_id);
+    return true;
+}
+
+struct BagStats {
+    uint64_t messages{0};  // Number of messages that were written
+    uint64_t bytes{0};  // Number of bytes that were written, including the records, indices and footers
+    uint32_t segments{0};  // Number of segments that were started
+};
+
+/**
+ * Records the raw messages of any number of topics into a bag (see BAG_VERSION for the layout).
+ *
+ * Recording one file per frame (per topic) spends most of the time on creating, and writing the metadata of,
+ * many small files. A bag appends the messages, exactly as they were received, to large segment files instead,
+ * and keeps a compact index in memory, which is written at the end of each segment. So the writes are sequential,
+ * and nothing is decoded or re-encoded. A new segment is started once a segment grows beyond segment_size,
+ * so that a long recording can be copied, and read, in pieces, and a crash loses at most the index of one segment.
+ *
+ * The frame_id and time of each message are read from the message (see readMessageStamp). For other messages,
+ * pass them to append, or otherwise the time at which the message was appended, and the number of messages of
+ * that topic before it, are used.
+ *
+ * append can be called from several threads (e.g. from the callbacks of several subscribers).
+ * The bag is finished by close, or when the writer is destroyed.
+ */
+class BagWriter {
+public:
+    static constexpr uint64_t DEFAULT_SEGMENT_SIZE = uint64_t(1) << 30;
+
+    explicit BagWriter(std::string prefix_arg, uint64_t segment_size_arg = DEFAULT_SEGMENT_SIZE,
+                       size_t buffer_size = 4 << 20)
+        : prefix(std::move(prefix_arg)), segment_size(segment_size_arg), buffer(buffer_size) {}
+
+    BagWriter(const BagWriter &) = delete;
+    BagWriter &operator=(const BagWriter &) = delete;
+
+    ~BagWriter() { close(); }
+
+    // Append a message of topic, reading its time and frame_id from the message if possible
+    bool append(const Topic &topic, const void *data, size_t size) {
+        Span<const uint8_t> frame(static_cast<const uint8_t *>(data), size);
+        return appendRange(topic, &frame, &frame + 1);
+    }
+
+    bool append(const Topic &topic, const void *data, size_t size, uint64_t time, uint64_t frame_id) {
+        Span<const uint8_t> frame(static_cast<const uint8_t *>(data), size);
+        return appendRange(topic, &frame, &frame + 1, &time, &frame_id);
+    }
+
+    /**
+     * Append a message that is split into frames, e.g. a multipart message (see recvFrames), as one message,
+     * without reassembling it first. Any container of objects with data() and size() methods works,
+     * e.g. std::vector<::zmq::message_t>.
+     */
+    template <typename Frames>
+    bool appendFrames(const Topic &topic, const Frames &frames) {
+        return appendRange(topic, std::begin(frames), std::end(frames));
+    }
+
+    // Write the index of the last segment, and close it. Returns false if anything could not be written.
+    bool close() {
+        std::lock_guard<std::mutex> lock(guard);
+        return finishSegment();
+    }
+
+    [[nodiscard]] BagStats stats() const {
+        std::lock_guard<std::mutex> lock(guard);
+        return bag_stats;
+    }
+
+private:
+    struct TopicState {
+        std::string name;
+        uint16_t port;
+        uint64_t messages;
+        bool in_segment;  // Whether the current segment has a record for this topic
+    };
+
+    const std::string prefix;
+    const uint64_t segment_size;
+    mutable std::mutex guard;
+    std::vector<char> buffer;
+    std::FILE *file = nullptr;
+    uint32_t next_segment = 0;
+    uint64_t offset = 0;  // The size of the current segment so far
+    bool failed = false;  // Whether a write to the current segment failed
+    std::vector<TopicState> topics;
+    std::vector<BagIndexEntry> index;
+    BagStats bag_stats;
+
+    template <typename Iterator>
+    bool appendRange(const Topic &topic, Iterator begin, Iterator end, const uint64_t *time = nullptr,
+                     const uint64_t *frame_id = nullptr) {
+        uint64_t size = 0;
+        for (auto frame = begin; frame != end; ++frame) {
+            size += frame->size();
+        }
+        if (size == 0) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(guard);
+        if (file and offset + sizeof(BagRecordHeader) + size > segment_size and not index.empty() and
+            not finishSegment()) {
+            return false;
+        }
+        if (not file and not startSegment()) {
+            return false;
+        }
+
+        const auto topic_id = findTopic(topic);
+        auto &state = topics[topic_id];
+        BagIndexEntry entry{};
+        entry.topic = topic_id;
+        entry.frame_id = frame_id ? *frame_id : state.messages;
+        entry.time = time ? *time : now();
+        if (not time and not frame_id and begin != end) {
+            // The header of a message is always in its first frame
+            readMessageStamp(static_cast<const uint8_t *>(begin->data()), begin->size(), entry.time, entry.frame_id);
+        }
+        if (not state.in_segment) {
+            writeTopicRecord(topic_id);
+            state.in_segment = true;
+        }
+        BagRecordHeader header{BagRecordHeader::MESSAGE, topic_id, 0, size};
+        write(&header, sizeof(header));
+        entry.offset = offset;
+        entry.size = size;
+        for (auto frame = begin; frame != end; ++frame) {
+            write(frame->data(), frame->size());
+        }
+        pad(size);
+        if (failed) {
+            std::cerr << "Could not write a message of " << topic.name << ": " << std::strerror(errno) << std::endl;
+            // The segment ends with a partial record, so finish it, and continue in a new segment
+            finishSegment();
+            return false;
+        }
+        index.push_back(entry);
+        ++state.messages;
+        ++bag_stats.messages;
+        return true;
+    }
+
+    static uint64_t now() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         std::chrono::system_clock::now().time_since_epoch())
+                                         .count());
+    }
+
+    uint16_t findTopic(const Topic &topic) {
+        for (size_t i = 0; i < topics.size(); ++i) {
+            if (topics[i].port == topic.port and topics[i].name == topic.name) {
+                return static_cast<uint16_t>(i);
+            }
+        }
+        topics.push_back(TopicState{topic.name, topic.port, 0, false});
+        return static_cast<uint16_t>(topics.size() - 1);
+    }
+
+    bool startSegment() {
+        const auto path = bagSegmentPath(prefix, next_segment);
+        file = std::fopen(path.c_str(), "wb");
+        if (not file) {
+            std::cerr << "Could not create the bag segment " << path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        // Messages are mostly larger than the buffer, and are then written straight from the message,
+        // so the buffer only gathers the record headers, the index, and the small messages
+        std::setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+        std::cout << "Recording to " << path << std::endl;
+        BagSegmentHeader header{};
+        std::memcpy(header.magic, BAG_SEGMENT_MAGIC, sizeof(header.magic));
+        header.version = BAG_VERSION;
+        header.segment = next_segment++;
+        offset = 0;
+        write(&header, sizeof(header));
+        ++bag_stats.segments;
+        return true;
+    }
+
+    // Write the index, the topic table, and the footer, and close the current segment
+    bool finishSegment() {
+        if (not file) {
+            return true;
+        }
+        BagFooter footer{};
+        footer.index_offset = offset;
+        footer.index_size = index.size();
+        write(index.data(), index.size() * sizeof(BagIndexEntry));
+        footer.topics_offset = offset;
+        for (size_t i = 0; i < topics.size(); ++i) {
+            if (topics[i].in_segment) {
+                writeTopicEntry(static_cast<uint16_t>(i));
+                ++footer.topics_size;
+            }
+        }
+        std::memcpy(footer.magic, BAG_FOOTER_MAGIC, sizeof(footer.magic));
+        write(&footer, sizeof(footer));
+        const auto success = not failed and std::fclose(file) == 0;
+        if (not success) {
+            std::cerr << "Could not finish the bag segment " << bagSegmentPath(prefix, next_segment - 1) << ": "
+                      << std::strerror(errno) << std::endl;
+        }
+        file = nullptr;
+        failed = false;
+        index.clear();
+        for (auto &topic : topics) {
+            topic.in_segment = false;
+        }
+        return success;
+    }
+
+    void writeTopicRecord(uint16_t id) {
+        const auto size = sizeof(BagTopicEntry) + topics[id].name.size();
+        BagRecordHeader header{BagRecordHeader::TOPIC, id, 0, size};
+        write(&header, sizeof(header));
+        writeTopicEntry(id);
+    }
+
+    void writeTopicEntry(uint16_t id) {
+        const auto &topic = topics[id];
+        BagTopicEntry entry{id, topic.port, static_cast<uint32_t>(topic.name.size())};
+        write(&entry, sizeof(entry));
+        write(topic.name.data(), topic.name.size());
+        pad(sizeof(entry) + topic.name.size());
+    }
+
+    void write(const void *data, size_t size) {
+        if (size > 0 and std::fwrite(data, 1, size, file) != size) {
+            failed = true;
+        }
+        offset += size;
+        bag_stats.bytes += size;
+    }
+
+    void pad(uint64_t size) {
+        static constexpr char zeros[BAG_ALIGNMENT] = {};
+        write(zeros, bagPadding(size));
+    }
+};
+
+}  // namespace zmq
+}  // namespace nodar
@@ -0,0 +1,408 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <nodar/zmq/topic_ports.hpp>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "bag.hpp"
+#include "image.hpp"
+#include "message_info.hpp"
+#include "point_cloud_soup.hpp"
+#include "span.hpp"
+#include "utils.hpp"
+
+namespace nodar {
+namespace zmq {
+
+// One message in a bag. The data, and the name of the topic, point into memory of the reader, which owner keeps alive.
+struct BagMessage {
+    Topic topic{};
+    uint64_t frame_id{};
+    uint64_t time{};
+    Span<const uint8_t> data;
+    std::shared_ptr<const void> owner;
+
+    [[nodiscard]] bool empty() const { return data.empty(); }
+
+    // The MessageInfo at the start of the message, which tells what type of message it is
+    [[nodiscard]] MessageInfo info() const {
+        MessageInfo info_;
+        if (data.size() >= sizeof(info_)) {
+            utils::read(data.data(), info_);
+        }
+        return info_;
+    }
+};
+
+/**
+ * Reads the messages of a bag that was recorded with BagWriter, in any order, without copying or decoding them.
+ *
+ * Every segment of the bag is memory-mapped, and only its index is read up front, so opening even an hour-long
+ * recording only reads a few MB. A message is found through the index, and is returned as a view into the mapping,
+ * so the operating system only reads the pages of the messages that are actually looked at.
+ * Skipping through a recording therefore costs nothing for the frames in between.
+ *
+ * The messages of each topic are numbered in the order in which they were recorded (0 to count(topic) - 1):
+ * - message(topic, i), image(topic, i) and soup(topic, i) look up the i-th message in O(1),
+ * - findFrame(topic, frame_id) finds a frame in O(1) if no frames were dropped, and in O(log n) otherwise,
+ * - findTime(topic, time) finds the first message at or after a time in O(log n),
+ * where n is the number of messages of the topic. Both expect the frame_id and time of a topic to increase.
+ *
+ *     nodar::zmq::BagReader bag("recordings/20250101-120000");
+ *     for (size_t i = 0; i < bag.count(nodar::zmq::SOUP_TOPIC); ++i) {
+ *         const auto soup = bag.soup(nodar::zmq::SOUP_TOPIC, i);
+ *         ...
+ *     }
+ *
+ * The views (and the names of their topics) keep the mapping of their segment alive, so they remain valid after the
+ * reader is destroyed.
+ * A segment whose index was never written (e.g. because the recorder crashed) is indexed by scanning its records.
+ * On Windows, the segments are read into memory instead of being mapped.
+ */
+class BagReader {
+public:
+    // Open the bag with the given prefix (see bagSegmentPath), or the segment with the given path
+    explicit BagReader(const std::string &path) {
+        for (uint32_t segment = 0;; ++segment) {
+            const auto segment_path = bagSegmentPath(path, segment);
+            if (not std::ifstream(segment_path)) {
+                if (segment == 0 and std::ifstream(path)) {
+                    // A single segment
+                    openSegment(path);
+                }
+                break;
+            }
+            if (not openSegment(segment_path)) {
+                break;
+            }
+        }
+        if (segments.empty()) {
+            std::cerr << "Could not find a bag at " << path << std::endl;
+        }
+    }
+
+    BagReader(const BagReader &) = delete;
+    BagReader &operator=(const BagReader &) = delete;
+
+    // True if no segment could be read
+    [[nodiscard]] bool empty() const { return segments.empty(); }
+
+    // The topics that were recorded
+    [[nodiscard]] std::vector<Topic> topics() const {
+        std::vector<Topic> result;
+        for (const auto &topic : recorded) {
+            result.push_back({topic.name->c_str(), topic.port});
+        }
+        return result;
+    }
+
+    // The number of messages of topic
+    [[nodiscard]] size_t count(const Topic &topic) const {
+        const auto recorded_topic = find(topic);
+        return recorded_topic ? recorded_topic->entries.size() : 0;
+    }
+
+    // The i-th message of topic, or an empty message if there is no such message
+    [[nodiscard]] BagMessage message(const Topic &topic, size_t i) const {
+        const auto recorded_topic = find(topic);
+        if (not recorded_topic or i >= recorded_topic->entries.size()) {
+            return {};
+        }
+        const auto &entry = recorded_topic->entries[i];
+        const auto &segment = segments[entry.segment];
+        return {{recorded_topic->name->c_str(), recorded_topic->port},
+                entry.frame_id,
+                entry.time,
+                Span<const uint8_t>(segment.data + entry.offset, entry.size),
+                segment.owner};
+    }
+
+    // View the i-th message of topic as a StampedImage. The view is empty if it is not a StampedImage.
+    [[nodiscard]] StampedImageView image(const Topic &topic, size_t i) const {
+        const auto msg = message(topic, i);
+        if (msg.empty() or msg.info() != StampedImage::getInfo()) {
+            return {};
+        }
+        return {msg.data.data(), msg.data.size(), msg.owner};
+    }
+
+    // View the i-th message of topic as a PointCloudSoup. The view is empty if it is not a PointCloudSoup.
+    [[nodiscard]] PointCloudSoupView soup(const Topic &topic, size_t i) const {
+        const auto msg = message(topic, i);
+        if (msg.empty() or msg.info() != PointCloudSoup::getInfo()) {
+            return {};
+        }
+        return {msg.data.data(), msg.data.size(), msg.owner};
+    }
+
+    // The number of the message of topic with the given frame_id, or count(topic) if there is none
+    [[nodiscard]] size_t findFrame(const Topic &topic, uint64_t frame_id) const {
+        const auto recorded_topic = find(topic);
+        if (not recorded_topic or recorded_topic->entries.empty()) {
+            return 0;
+        }
+        const auto &entries = recorded_topic->entries;
+        // Unless frames were dropped, a frame is as far from the first frame as its frame_id
+        const auto guess = frame_id - entries.front().frame_id;
+        if (frame_id >= entries.front().frame_id and guess < entries.size() and entries[guess].frame_id == frame_id) {
+            return guess;
+        }
+        const auto it = std::lower_bound(entries.begin(), entries.end(), frame_id,
+                                         [](const Entry &entry, uint64_t id) { return entry.frame_id < id; });
+        return it != entries.end() and it->frame_id == frame_id ? static_cast<size_t>(it - entries.begin())
+                                                                : entries.size();
+    }
+
+    // The number of the first message of topic at or after time, or count(topic) if there is none
+    [[nodiscard]] size_t findTime(const Topic &topic, uint64_t time) const {
+        const auto recorded_topic = find(topic);
+        if (not recorded_topic) {
+            return 0;
+        }
+        const auto &entries = recorded_topic->entries;
+        return static_cast<size_t>(std::lower_bound(entries.begin(), entries.end(), time,
+                                                    [](const Entry &entry, uint64_t t) { return entry.time < t; }) -
+                                   entries.begin());
+    }
+
+private:
+    struct Segment {
+        const uint8_t *data;
+        uint64_t size;
+        // Unmaps (or frees) the segment once the reader and all the views of its messages are gone
+        std::shared_ptr<const void> owner;
+    };
+
+    struct Entry {
+        uint32_t segment;
+        uint64_t frame_id;
+        uint64_t time;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct RecordedTopic {
+        const std::string *name;  // In names
+        uint16_t port;
+        std::vector<Entry> entries;
+    };
+
+    // What the owner of a message keeps alive
+    struct Owned {
+        std::shared_ptr<const void> mapping;
+        std::shared_ptr<const std::deque<std::string>> names;
+    };
+
+    std::vector<Segment> segments;
+    std::vector<RecordedTopic> recorded;
+    // The names of the topics, which are shared with the messages, so that the names in their topics do not dangle.
+    // A deque, so that adding a name does not move the others.
+    std::shared_ptr<std::deque<std::string>> names = std::make_shared<std::deque<std::string>>();
+
+    const RecordedTopic *find(const Topic &topic) const {
+        for (const auto &recorded_topic : recorded) {
+            if (recorded_topic.port == topic.port and *recorded_topic.name == topic.name) {
+                return &recorded_topic;
+            }
+        }
+        return nullptr;
+    }
+
+    // The topic with the given name and port, which is added if it was not recorded in any previous segment
+    uint32_t addTopic(const uint8_t *entry_data, uint64_t available) {
+        BagTopicEntry entry;
+        utils::read(entry_data, entry);
+        const std::string name(reinterpret_cast<const char *>(entry_data) + sizeof(entry),
+                               std::min<uint64_t>(entry.name_size, available - sizeof(entry)));
+        for (size_t i = 0; i < recorded.size(); ++i) {
+            if (recorded[i].port == entry.port and *recorded[i].name == name) {
+                return static_cast<uint32_t>(i);
+            }
+        }
+        names->push_back(name);
+        recorded.push_back({&names->back(), entry.port, {}});
+        return static_cast<uint32_t>(recorded.size() - 1);
+    }
+
+    bool openSegment(const std::string &path) {
+        Segment segment{};
+        if (not map(path, segment)) {
+            return false;
+        }
+        BagSegmentHeader header;
+        if (segment.size < sizeof(header)) {
+            std::cerr << path << " is too small to be a bag segment." << std::endl;
+            return false;
+        }
+        utils::read(segment.data, header);
+        if (std::memcmp(header.magic, BAG_SEGMENT_MAGIC, sizeof(header.magic)) != 0 or
+            header.version != BAG_VERSION) {
+            std::cerr << path << " either is not a bag segment, or is a different bag version." << std::endl;
+            return false;
+        }
+        segment.owner = std::make_shared<Owned>(Owned{std::move(segment.owner), names});
+        segments.push_back(segment);
+        if (not readIndex(segment, static_cast<uint32_t>(segments.size() - 1))) {
+            std::cerr << "The index of " << path
+                      << " is missing or corrupt, so its messages are indexed by scanning it." << std::endl;
+            scan(segment, static_cast<uint32_t>(segments.size() - 1));
+        }
+        return true;
+    }
+
+    // Read the index and the topic table at the end of a segment
+    bool readIndex(const Segment &segment, uint32_t segment_number) {
+        BagFooter footer;
+        if (segment.size < sizeof(BagSegmentHeader) + sizeof(footer)) {
+            return false;
+        }
+        const auto footer_offset = segment.size - sizeof(footer);
+        utils::read(segment.data + footer_offset, footer);
+        if (std::memcmp(footer.magic, BAG_FOOTER_MAGIC, sizeof(footer.magic)) != 0 or
+            footer.index_offset > footer_offset or
+            footer.index_size > (footer_offset - footer.index_offset) / sizeof(BagIndexEntry) or
+            footer.topics_offset > footer_offset) {
+            return false;
+        }
+
+        // Check that the whole topic table lies before the footer, before adding any of its topics
+        std::vector<uint64_t> topic_offsets;
+        auto offset = footer.topics_offset;
+        for (uint64_t i = 0; i < footer.topics_size; ++i) {
+            BagTopicEntry entry;
+            if (offset > footer_offset or footer_offset - offset < sizeof(entry)) {
+                return false;
+            }
+            utils::read(segment.data + offset, entry);
+            if (entry.name_size > footer_offset - offset - sizeof(entry)) {
+                return false;
+            }
+            topic_offsets.push_back(offset);
+            offset += sizeof(entry) + entry.name_size + bagPadding(sizeof(entry) + entry.name_size);
+        }
+
+        // The IDs of the topics in this segment, mapped to the topics of the whole bag
+        std::vector<uint32_t> topic_ids;
+        for (const auto topic_offset : topic_offsets) {
+            BagTopicEntry entry;
+            utils::read(segment.data + topic_offset, entry);
+            topic_ids.resize(std::max<size_t>(topic_ids.size(), entry.id + 1), UINT32_MAX);
+            topic_ids[entry.id] = addTopic(segment.data + topic_offset, footer_offset - topic_offset);
+        }
+
+        for (uint64_t i = 0; i < footer.index_size; ++i) {
+            BagIndexEntry entry;
+            utils::read(segment.data + footer.index_offset + i * sizeof(entry), entry);
+            if (entry.topic >= topic_ids.size() or topic_ids[entry.topic] == UINT32_MAX or
+                entry.offset > footer.index_offset or entry.size > footer.index_offset - entry.offset) {
+                std::cerr << "Skipping an index entry that points outside of its segment." << std::endl;
+                continue;
+            }
+            recorded[topic_ids[entry.topic]].entries.push_back(
+                {segment_number, entry.frame_id, entry.time, entry.offset, entry.size});
+        }
+        return true;
+    }
+
+    // Index a segment without an index by walking its records, up to the first record that is cut off
+    void scan(const Segment &segment, uint32_t segment_number) {
+        std::vector<uint32_t> topic_ids;
+        std::vector<uint64_t> counts;
+        uint64_t offset = sizeof(BagSegmentHeader);
+        BagRecordHeader header;
+        while (segment.size - offset >= sizeof(header)) {
+            utils::read(segment.data + offset, header);
+            offset += sizeof(header);
+            if (header.size > segment.size - offset) {
+                break;
+            }
+            const auto data = segment.data + offset;
+            BagTopicEntry topic_entry{};
+            if (header.size >= sizeof(topic_entry)) {
+                utils::read(data, topic_entry);
+            }
+            if (header.kind == BagRecordHeader::TOPIC and header.size == sizeof(topic_entry) + topic_entry.name_size and
+                topic_entry.id == header.topic) {
+                topic_ids.resize(std::max<size_t>(topic_ids.size(), header.topic + 1), UINT32_MAX);
+                topic_ids[header.topic] = addTopic(data, header.size);
+            } else if (header.kind == BagRecordHeader::MESSAGE and header.topic < topic_ids.size() and
+                       topic_ids[header.topic] != UINT32_MAX) {
+                auto &entries = recorded[topic_ids[header.topic]].entries;
+                Entry entry{segment_number, entries.size(), 0, offset, header.size};
+                readMessageStamp(data, header.size, entry.time, entry.frame_id);
+                entries.push_back(entry);
+            } else {
+                break;
+            }
+            offset += header.size + bagPadding(header.size);
+            if (offset > segment.size) {
+                break;
+            }
+        }
+    }
+
+#ifndef _WIN32
+    static bool map(const std::string &path, Segment &segment) {
+        const auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Could not open " << path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        struct stat status {};
+        if (fstat(fd, &status) != 0 or status.st_size == 0) {
+            std::cerr << "Could not read " << path << ": " << std::strerror(errno) << std::endl;
+            ::close(fd);
+            return false;
+        }
+        const auto size = static_cast<size_t>(status.st_size);
+        const auto base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        // The mapping stays valid after the file is closed
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            std::cerr << "Could not map " << path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        segment.data = static_cast<const uint8_t *>(base);
+        segment.size = size;
+        segment.owner = std::shared_ptr<const void>(base, [size](const void *mapped) {
+            munmap(const_cast<void *>(mapped), size);
+        });
+        return true;
+    }
+#else
+    static bool map(const std::string &path, Segment &segment) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (not file) {
+            std::cerr << "Could not open " << path << std::endl;
+            return false;
+        }
+        auto contents = std::make_shared<std::vector<uint8_t>>(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        if (not file.read(reinterpret_cast<char *>(contents->data()), static_cast<std::streamsize>(contents->size()))) {
+            std::cerr << "Could not read " << path << std::endl;
+            return false;
+        }
+        segment.data = contents->data();
+        segment.size = contents->size();
+        segment.owner = std::move(contents);
+        return true;
+    }
+#endif
+};
+
+}  // namespace zmq
+}  // namespace nodar
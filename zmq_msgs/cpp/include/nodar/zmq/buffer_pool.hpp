@@ -1,24 +1,74 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace nodar {
 namespace zmq {
 
+/**
+ * An allocator that default-initializes (rather than value-initializes) elements that are constructed without a value.
+ * For a std::vector<uint8_t>, this means that resize leaves the new bytes uninitialized instead of zero-filling them,
+ * which is what we want for buffers that are about to be overwritten by a message anyway.
+ */
+template <typename T>
+struct DefaultInitAllocator : std::allocator<T> {
+    template <typename U>
+    struct rebind {
+        using other = DefaultInitAllocator<U>;
+    };
+
+    DefaultInitAllocator() = default;
+
+    template <typename U>
+    DefaultInitAllocator(const DefaultInitAllocator<U> &) noexcept {}
+
+    template <typename U>
+    void construct(U *ptr) noexcept(std::is_nothrow_default_constructible<U>::value) {
+        ::new (static_cast<void *>(ptr)) U;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U *ptr, Args &&...args) {
+        ::new (static_cast<void *>(ptr)) U(std::forward<Args>(args)...);
+    }
+};
+
 struct BufferPool;
 class Buffer {
-    std::vector<uint8_t> vec{};
+    std::vector<uint8_t, DefaultInitAllocator<uint8_t>> vec{};
 
 public:
     BufferPool* buffer_pool;
+    // Only set while the buffer is lent out (see BufferPool::lend)
+    std::shared_ptr<BufferPool> lender;
     explicit Buffer(BufferPool* pool) : buffer_pool(pool) {}
     Buffer(size_t size, BufferPool* pool) : vec(size), buffer_pool(pool) {}
     [[nodiscard]] auto size() const { return vec.size(); }
     [[nodiscard]] auto capacity() const { return vec.capacity(); }
     [[nodiscard]] auto data() { return vec.data(); }
+    // Note that growing the buffer does not zero-fill the new bytes
     void resize(size_t size) { vec.resize(size); }
+    void reserve(size_t capacity) { vec.reserve(capacity); }
+
+    // Write to every page of the buffer, so that the first message written into it does not page fault
+    void prefault() {
+        const auto size = vec.size();
+        vec.resize(vec.capacity());
+        std::memset(vec.data(), 0, vec.size());
+        vec.resize(size);
+    }
 
     /**
      * Release a buffer back to the pool. This is the signature that is used by ZMQ.
@@ -27,46 +77,232 @@ public:
     static void release(void* data, void* hint);
 };
 
-struct BufferPool {
+/**
+ * A bounded, lock-free, multi-producer multi-consumer queue of buffers.
+ * This is Dmitry Vyukov's bounded MPMC queue:
+ * https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ * Each cell carries a sequence number that tells producers and consumers whether it is their turn to use it,
+ * so push and pop only need a single compare-and-swap in the uncontended case, and never allocate.
+ */
+class BufferQueue {
+public:
+    static constexpr size_t CAPACITY = 64;
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "The capacity of a BufferQueue must be a power of 2");
+
+    BufferQueue() {
+        for (size_t i = 0; i < CAPACITY; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns false if the queue is full.
+    // Note that this can also happen spuriously, if a consumer is preempted halfway through popping the cell
+    // that this push needs (which is the price of the queue being lock-free).
+    bool push(Buffer* buffer) {
+        auto pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            auto& cell = cells[pos & (CAPACITY - 1)];
+            const auto sequence = cell.sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.buffer = buffer;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Returns nullptr if the queue is empty
+    Buffer* pop() {
+        auto pos = dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            auto& cell = cells[pos & (CAPACITY - 1)];
+            const auto sequence = cell.sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    const auto buffer = cell.buffer;
+                    cell.sequence.store(pos + CAPACITY, std::memory_order_release);
+                    return buffer;
+                }
+            } else if (diff < 0) {
+                return nullptr;
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Buffer* buffer = nullptr;
+    };
+    std::array<Cell, CAPACITY> cells;
+    // Keep the two positions on separate cache lines, so that producers and consumers do not contend
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) std::atomic<size_t> dequeue_pos{0};
+};
+
+struct BufferPool : std::enable_shared_from_this<BufferPool> {
+    // Buffers are binned by capacity into size classes, 2^SUB_CLASS_BITS per power of 2, so that a new buffer is at
+    // most 25% larger than the request that it was made for (e.g. a 24 MB frame gets a 24 MB buffer, not 32 MB).
+    // Class 0 holds buffers smaller than 2^MIN_SIZE_CLASS_BITS bytes,
+    // and class k > 0 holds buffers with a capacity in [classFloor(k), classFloor(k + 1)).
+    static constexpr size_t MIN_SIZE_CLASS_BITS = 10;
+    static constexpr size_t SUB_CLASS_BITS = 2;
+    // Up to 2^36 bytes
+    static constexpr size_t NUM_SIZE_CLASSES = 1 + (26 << SUB_CLASS_BITS);
+    // How many size classes above the requested one get() will look in, before it decides to make a new buffer,
+    // i.e. up to twice the requested size.
+    // This stops small requests from taking (and so stealing) the large buffers that other messages need.
+    static constexpr size_t MAX_SIZE_CLASS_SKIP = size_t{1} << SUB_CLASS_BITS;
+
     // Maintain a list of all created buffers. This ensures that all buffers are destroyed when the pool is destroyed.
     std::list<Buffer> created;
-    // A list of all the buffers that are available, that is, the buffers that have been returned to the pool.
-    std::list<Buffer*> available;
-    // Mutexes for thread safety
+    // Buffers that could not be pushed into their (lock-free) queue, because it was full.
+    std::vector<Buffer*> spilled;
+    // Guards created and spilled. These are only touched on the slow paths, so the mutex is not taken in steady state.
     std::mutex created_guard;
-    std::mutex available_guard;
+    // The buffers that are available, that is, the buffers that have been returned to the pool, binned by size class.
+    std::array<BufferQueue, NUM_SIZE_CLASSES> available;
 
     /**
-     * Get a buffer. If none are available, then make a new one.
+     * Get a buffer with a capacity of at least min_capacity bytes.
+     * The smallest size class that can satisfy the request is searched first, followed by the next few larger classes,
+     * so a large request is never handed a small buffer that would then have to be reallocated,
+     * and a small request never takes a buffer that is far larger than it needs.
+     * If none are available, then make a new one, whose capacity is rounded up to its size class,
+     * so that it satisfies the same request again once it has been returned to the pool.
+     * If min_capacity is 0, then the smallest available buffer of any size is returned.
+     *
      * Note that this function returns a pointer,
      * but the ownership of the buffer is maintained by the buffer pool.
      * When the BufferPool is destroyed, all the buffers created by it are destroyed.
      * You should never call delete on a buffer that was created by a BufferPool.
      */
-    auto get() {
-        Buffer* buffer = nullptr;
-        {
-            std::lock_guard<std::mutex> lock(available_guard);
-            if (not available.empty()) {
-                buffer = available.front();
-                available.pop_front();
+    Buffer* get(size_t min_capacity = 0) {
+        const auto first_class = getSizeClass(min_capacity);
+        const auto last_class = min_capacity == 0 ? NUM_SIZE_CLASSES - 1
+                                                  : std::min(first_class + MAX_SIZE_CLASS_SKIP, NUM_SIZE_CLASSES - 1);
+        for (auto size_class = first_class; size_class <= last_class; ++size_class) {
+            if (const auto buffer = available[size_class].pop()) {
+                return buffer;
             }
         }
-        if (not buffer) {
+        Buffer* buffer = nullptr;
+        {
             std::lock_guard<std::mutex> lock(created_guard);
+            for (auto it = spilled.begin(); it != spilled.end(); ++it) {
+                const auto size_class = putSizeClass((*it)->capacity());
+                if (size_class >= first_class and size_class <= last_class) {
+                    buffer = *it;
+                    spilled.erase(it);
+                    return buffer;
+                }
+            }
             created.emplace_back(this);
             buffer = &created.back();
         }
+        buffer->reserve(classCapacity(min_capacity));
+        return buffer;
+    }
+
+    /**
+     * Like get(), but the buffer holds a reference to this pool until it is put back,
+     * so that the pool outlives its owner for as long as e.g. a ZMQ socket still holds the buffer.
+     * Only call this on a pool that is owned by a std::shared_ptr.
+     */
+    Buffer* lend(size_t min_capacity = 0) {
+        const auto buffer = get(min_capacity);
+        buffer->lender = shared_from_this();
         return buffer;
     }
 
+    /**
+     * Pre-warm the pool with count buffers that can each hold at least bytes bytes.
+     * The buffers are allocated and their pages are touched up front, so that the first messages after startup
+     * pay neither the allocation nor the page-fault latency. Call this at startup, before any buffers are in use.
+     */
+    void reserve(size_t count, size_t bytes) {
+        std::vector<Buffer*> buffers;
+        buffers.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            {
+                std::lock_guard<std::mutex> lock(created_guard);
+                created.emplace_back(this);
+                buffers.push_back(&created.back());
+            }
+            buffers.back()->reserve(classCapacity(bytes));
+            buffers.back()->prefault();
+        }
+        for (const auto buffer : buffers) {
+            put(buffer);
+        }
+    }
+
     /**
      * Return a buffer to the pool so that it can be reused in subsequent calls to get().
      * The buffer pointer must have been created by the same BufferPool.
+     * This is lock-free, since it is usually called from the ZMQ I/O thread (see Buffer::release),
+     * unless the queue for the size class is full, in which case the buffer is spilled into a list instead.
      */
     void put(Buffer* buffer) {
-        std::lock_guard<std::mutex> lock(available_guard);
-        available.push_back(buffer);
+        // A lent buffer may hold the last reference to this pool, so only let go of it once the buffer is back
+        const auto lender = std::move(buffer->lender);
+        if (not available[putSizeClass(buffer->capacity())].push(buffer)) {
+            std::lock_guard<std::mutex> lock(created_guard);
+            spilled.push_back(buffer);
+        }
+    }
+
+private:
+    // The smallest capacity in size class k > 0
+    static size_t classFloor(size_t size_class) {
+        const auto octave = (size_class - 1) >> SUB_CLASS_BITS;
+        const auto step = (size_class - 1) & ((size_t{1} << SUB_CLASS_BITS) - 1);
+        const auto base = size_t{1} << (octave + MIN_SIZE_CLASS_BITS);
+        return base + step * (base >> SUB_CLASS_BITS);
+    }
+
+    // The size class that a buffer with the given capacity belongs to
+    static size_t putSizeClass(size_t capacity) {
+        if (capacity < (size_t{1} << MIN_SIZE_CLASS_BITS)) {
+            return 0;
+        }
+        size_t bits = MIN_SIZE_CLASS_BITS;
+        while ((capacity >> bits) > 1) {
+            ++bits;
+        }
+        const auto octave = bits - MIN_SIZE_CLASS_BITS;
+        const auto step = (capacity >> (bits - SUB_CLASS_BITS)) & ((size_t{1} << SUB_CLASS_BITS) - 1);
+        return std::min(1 + (octave << SUB_CLASS_BITS) + step, NUM_SIZE_CLASSES - 1);
+    }
+
+    // The smallest size class in which every buffer has a capacity of at least min_capacity
+    static size_t getSizeClass(size_t min_capacity) {
+        if (min_capacity == 0) {
+            return 0;
+        }
+        const auto size_class = std::max<size_t>(putSizeClass(min_capacity), 1);
+        if (classFloor(size_class) < min_capacity) {
+            return std::min(size_class + 1, NUM_SIZE_CLASSES - 1);
+        }
+        return size_class;
+    }
+
+    // The capacity that a new buffer needs in order to be found by get(min_capacity) after it is returned to the pool
+    static size_t classCapacity(size_t min_capacity) {
+        if (min_capacity == 0) {
+            return 0;
+        }
+        return std::max(min_capacity, classFloor(getSizeClass(min_capacity)));
     }
 };
 
@@ -76,4 +312,4 @@ inline void Buffer::release(void* data, void* hint) {
 }
 
 }  // namespace zmq
-}  // namespace nodar
\ No newline at end of file
+}  // namespace nodar
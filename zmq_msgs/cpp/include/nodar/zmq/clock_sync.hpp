@@ -0,0 +1,346 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <nodar/zmq/topic_ports.hpp>
+#include <string>
+#include <thread>
+#include <zmq.hpp>
+
+#include "endpoint.hpp"
+#include "message_info.hpp"
+#include "utils.hpp"
+
+namespace nodar {
+namespace zmq {
+
+// The time of the system clock in ns since the epoch, which is what the time stamps of the messages use
+inline uint64_t systemTimeNs() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch())
+            .count());
+}
+
+/**
+ * A clock sync request, or its reply.
+ * The client fills in the sequence and client_send, and the server echoes them,
+ * along with the times at which it received the request and sent the reply (all in ns, each on its own clock).
+ */
+struct ClockSyncPacket {
+    static constexpr uint64_t MSG_SIZE = sizeof(MessageInfo) + 4 * sizeof(uint64_t);
+    static constexpr MessageInfo getInfo() { return MessageInfo(11); }
+
+    uint64_t sequence{};
+    uint64_t client_send{};
+    uint64_t server_receive{};
+    uint64_t server_send{};
+
+    auto write(uint8_t *dst) const {
+        dst = utils::append(dst, getInfo());
+        dst = utils::append(dst, sequence);
+        dst = utils::append(dst, client_send);
+        dst = utils::append(dst, server_receive);
+        dst = utils::append(dst, server_send);
+        return dst;
+    }
+
+    bool read(const uint8_t *src, size_t src_size) {
+        if (src_size < MSG_SIZE) {
+            std::cerr << "This message is too small to be a clock sync packet." << std::endl;
+            return false;
+        }
+        MessageInfo info;
+        src = utils::read(src, info);
+        if (info.is_different(getInfo(), "ClockSyncPacket")) {
+            return false;
+        }
+        src = utils::read(src, sequence);
+        src = utils::read(src, client_send);
+        src = utils::read(src, server_receive);
+        src = utils::read(src, server_send);
+        return true;
+    }
+};
+
+/**
+ * Estimates the offset (server clock minus client clock) and the drift between two clocks from ping/pong exchanges,
+ * in the style of NTP.
+ *
+ * Every exchange gives an offset ((t2 - t1) + (t3 - t4)) / 2 and a round-trip delay (t4 - t1) - (t3 - t2),
+ * where t1 and t4 are the client times at which the ping was sent and the pong was received,
+ * and t2 and t3 are the server times at which the ping was received and the pong was sent.
+ * The error of the offset is at most half the delay, and samples with longer delays are mostly queueing noise.
+ * So, like the NTP clock filter, only the sample with the shortest delay among the last FILTER_SIZE is trusted.
+ * The drift is the slope of a least-squares line through the trusted offsets of the last DRIFT_WINDOW exchanges,
+ * which also predicts the offset between exchanges.
+ */
+class ClockOffsetFilter {
+public:
+    static constexpr size_t FILTER_SIZE = 8;
+    static constexpr size_t DRIFT_WINDOW = 32;
+
+    void add(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4) {
+        if (t4 < t1) {
+            return;  // The client clock stepped backwards during the exchange
+        }
+        Sample sample;
+        sample.local = t1 + (t4 - t1) / 2;
+        sample.offset = (static_cast<int64_t>(t2 - t1) + static_cast<int64_t>(t3 - t4)) / 2;
+        const auto server_time = static_cast<int64_t>(t3 - t2);
+        sample.delay = static_cast<uint64_t>(std::max<int64_t>(static_cast<int64_t>(t4 - t1) - server_time, 0));
+
+        recent.push_back(sample);
+        if (recent.size() > FILTER_SIZE) {
+            recent.pop_front();
+        }
+        const auto best = *std::min_element(recent.begin(), recent.end(),
+                                            [](const Sample &a, const Sample &b) { return a.delay < b.delay; });
+        // The best sample may stay the best for several exchanges. Only use it once to fit the drift.
+        if (trusted.empty() or trusted.back().local != best.local) {
+            trusted.push_back(best);
+            if (trusted.size() > DRIFT_WINDOW) {
+                trusted.pop_front();
+            }
+            fit();
+        }
+    }
+
+    [[nodiscard]] bool valid() const { return not trusted.empty(); }
+
+    // The predicted offset (server clock minus client clock) in ns at the given client time
+    [[nodiscard]] int64_t offsetAt(uint64_t local) const {
+        if (trusted.empty()) {
+            return 0;
+        }
+        const auto since = static_cast<double>(static_cast<int64_t>(local - reference_time));
+        return reference_offset + static_cast<int64_t>(drift * since);
+    }
+
+    // The rate at which the offset changes, e.g. 1e-5 means that the server clock gains 10 us per second
+    [[nodiscard]] double driftRate() const { return drift; }
+
+    // The round-trip delay of the trusted sample, which bounds the error of the offset to +/- half of it
+    [[nodiscard]] uint64_t delay() const { return trusted.empty() ? 0 : trusted.back().delay; }
+
+private:
+    struct Sample {
+        uint64_t local{};  // The client time halfway through the exchange
+        int64_t offset{};
+        uint64_t delay{};
+    };
+
+    std::deque<Sample> recent;
+    std::deque<Sample> trusted;
+    uint64_t reference_time = 0;
+    int64_t reference_offset = 0;
+    double drift = 0.0;
+
+    // Fit offset = reference_offset + drift * (local - reference_time) through the trusted samples
+    void fit() {
+        const auto &first = trusted.front();
+        double mean_x = 0.0;
+        double mean_y = 0.0;
+        for (const auto &sample : trusted) {
+            mean_x += static_cast<double>(static_cast<int64_t>(sample.local - first.local));
+            mean_y += static_cast<double>(sample.offset - first.offset);
+        }
+        mean_x /= trusted.size();
+        mean_y /= trusted.size();
+        double covariance = 0.0;
+        double variance = 0.0;
+        for (const auto &sample : trusted) {
+            const auto dx = static_cast<double>(static_cast<int64_t>(sample.local - first.local)) - mean_x;
+            const auto dy = static_cast<double>(sample.offset - first.offset) - mean_y;
+            covariance += dx * dy;
+            variance += dx * dx;
+        }
+        drift = variance > 0.0 ? covariance / variance : 0.0;
+        reference_time = first.local + static_cast<uint64_t>(mean_x);
+        reference_offset = first.offset + static_cast<int64_t>(mean_y);
+    }
+};
+
+/**
+ * Answers the clock sync requests of ClockSyncClients, so that subscribers on other hosts can convert the time stamps
+ * of the messages that are published on this host to their own clocks.
+ *
+ * Run one in the process that time stamps the messages (e.g. Hammerhead), or in any other process on its host.
+ * Only one server per host can bind CLOCK_SYNC_TOPIC, but they all answer with the same clock anyway,
+ * so a server that cannot bind just reports it and does nothing.
+ */
+class ClockSyncServer {
+public:
+    explicit ClockSyncServer(uint16_t port = CLOCK_SYNC_TOPIC.port) : context(1), socket(context, ZMQ_ROUTER) {
+        // Wake up regularly, so that the thread notices when it should stop
+        const int receive_timeout_ms = 100;
+        socket.set(::zmq::sockopt::rcvtimeo, receive_timeout_ms);
+        socket.set(::zmq::sockopt::linger, 0);
+        const auto endpoint = "tcp://*:" + std::to_string(port);
+        try {
+            socket.bind(endpoint);
+        } catch (const ::zmq::error_t &error) {
+            std::cerr << "Could not serve clock sync requests on " << endpoint << " (" << error.what()
+                      << "). Another process on this host is probably serving them already." << std::endl;
+            return;
+        }
+        std::cout << "Serving clock sync requests on " << endpoint << std::endl;
+        running = true;
+        serve_thread = std::thread(&ClockSyncServer::loop, this);
+    }
+
+    ClockSyncServer(const ClockSyncServer &) = delete;
+    ClockSyncServer &operator=(const ClockSyncServer &) = delete;
+
+    ~ClockSyncServer() {
+        running = false;
+        if (serve_thread.joinable()) {
+            serve_thread.join();
+        }
+    }
+
+private:
+    ::zmq::context_t context;
+    ::zmq::socket_t socket;
+    std::atomic_bool running{false};
+    std::thread serve_thread;
+
+    void loop() {
+        while (running) {
+            // A ROUTER socket receives {identity, request}, and routes {identity, reply} back to the client
+            ::zmq::message_t identity;
+            if (not socket.recv(identity)) {
+                continue;
+            }
+            ::zmq::message_t request;
+            if (not identity.more() or not socket.recv(request)) {
+                continue;
+            }
+            const auto received = systemTimeNs();
+            ClockSyncPacket packet;
+            if (request.more() or not packet.read(static_cast<const uint8_t *>(request.data()), request.size())) {
+                while (request.more() and socket.recv(request)) {
+                }
+                continue;
+            }
+            packet.server_receive = received;
+            packet.server_send = systemTimeNs();
+            ::zmq::message_t reply(ClockSyncPacket::MSG_SIZE);
+            packet.write(static_cast<uint8_t *>(reply.data()));
+            socket.send(identity, ::zmq::send_flags::sndmore);
+            socket.send(reply, ::zmq::send_flags::dontwait);
+        }
+    }
+};
+
+/**
+ * Keeps estimating the clock offset of a host that runs a ClockSyncServer, by pinging it every period.
+ *
+ * Convert a time stamp of a message that was published on that host to the clock of this host with toLocalTime,
+ * e.g. to measure the real end-to-end latency (see FrameStats::setClockOffset).
+ * Until the first pong arrives, the offset is 0, i.e. the clocks are assumed to be synchronized.
+ */
+class ClockSyncClient {
+public:
+    explicit ClockSyncClient(const std::string &ip, std::chrono::milliseconds period_arg = std::chrono::seconds(1),
+                             uint16_t port = CLOCK_SYNC_TOPIC.port)
+        : period(period_arg), context(1), socket(context, ZMQ_DEALER) {
+        socket.set(::zmq::sockopt::rcvtimeo, static_cast<int>(period.count()));
+        socket.set(::zmq::sockopt::linger, 0);
+        const auto endpoint = connectEndpoint(ip, port, Transport::TCP);
+        socket.connect(endpoint);
+        std::cout << "Synchronizing clocks with " << endpoint << std::endl;
+        sync_thread = std::thread(&ClockSyncClient::loop, this);
+    }
+
+    ClockSyncClient(const ClockSyncClient &) = delete;
+    ClockSyncClient &operator=(const ClockSyncClient &) = delete;
+
+    ~ClockSyncClient() {
+        {
+            std::lock_guard<std::mutex> lock(guard);
+            running = false;
+        }
+        wake.notify_all();
+        sync_thread.join();
+    }
+
+    [[nodiscard]] bool synchronized() const { return is_synchronized.load(std::memory_order_relaxed); }
+
+    // The offset (server clock minus client clock) in ns, as of the last exchange
+    [[nodiscard]] const std::atomic<int64_t> &offset() const { return offset_ns; }
+
+    [[nodiscard]] uint64_t toLocalTime(uint64_t remote_time) const {
+        return remote_time - static_cast<uint64_t>(offset_ns.load(std::memory_order_relaxed));
+    }
+
+    [[nodiscard]] double driftRate() const {
+        std::lock_guard<std::mutex> lock(guard);
+        return filter.driftRate();
+    }
+
+    // The round-trip delay of the exchange that the offset is based on, which bounds its error to +/- half of it
+    [[nodiscard]] uint64_t delay() const {
+        std::lock_guard<std::mutex> lock(guard);
+        return filter.delay();
+    }
+
+private:
+    const std::chrono::milliseconds period;
+    ::zmq::context_t context;
+    ::zmq::socket_t socket;
+    mutable std::mutex guard;
+    std::condition_variable wake;
+    bool running = true;
+    ClockOffsetFilter filter;
+    std::atomic<int64_t> offset_ns{0};
+    std::atomic_bool is_synchronized{false};
+    std::thread sync_thread;
+
+    void loop() {
+        uint64_t sequence = 0;
+        std::unique_lock<std::mutex> lock(guard);
+        while (running) {
+            lock.unlock();
+            exchange(++sequence);
+            lock.lock();
+            wake.wait_for(lock, period, [this] { return not running; });
+        }
+    }
+
+    // Send a ping and wait for its pong (for up to a period). Pongs of earlier pings that timed out are skipped.
+    void exchange(uint64_t sequence) {
+        ClockSyncPacket packet;
+        packet.sequence = sequence;
+        ::zmq::message_t request(ClockSyncPacket::MSG_SIZE);
+        packet.client_send = systemTimeNs();
+        packet.write(static_cast<uint8_t *>(request.data()));
+        if (not socket.send(request, ::zmq::send_flags::dontwait)) {
+            return;
+        }
+        for (;;) {
+            ::zmq::message_t reply;
+            if (not socket.recv(reply)) {
+                return;
+            }
+            const auto received = systemTimeNs();
+            ClockSyncPacket pong;
+            if (not pong.read(static_cast<const uint8_t *>(reply.data()), reply.size()) or pong.sequence != sequence) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(guard);
+            filter.add(pong.client_send, pong.server_receive, pong.server_send, received);
+            offset_ns.store(filter.offsetAt(received), std::memory_order_relaxed);
+            is_synchronized.store(filter.valid(), std::memory_order_relaxed);
+            return;
+        }
+    }
+};
+
+}  // namespace zmq
+}  // namespace nodar
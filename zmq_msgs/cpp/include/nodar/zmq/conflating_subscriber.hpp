@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <nodar/zmq/topic_ports.hpp>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <zmq.hpp>
+
+#include "endpoint.hpp"
+#include "multipart.hpp"
+#include "subscriber.hpp"
+
+namespace nodar {
+namespace zmq {
+
+struct ConflatingSubscriberStats {
+    uint64_t received{0};  // Number of messages received
+    uint64_t overwritten{0};  // Number of messages that were replaced by a newer one before they were taken
+};
+
+/**
+ * A subscriber that only ever keeps the newest message, for viewers and monitors that are slower than the stream.
+ *
+ * A background thread receives every message as soon as it arrives, and keeps the newest one as it is,
+ * i.e. as the frames that were received, without decoding it. So a consumer that takes a message with waitForNext()
+ * always gets the freshest one, and only decodes the messages that it actually uses (e.g. one per repaint),
+ * so a viewer never lags behind the stream when drawing is slow. Waiting times out, so that the loop of the consumer
+ * can check whether it should stop.
+ * Just setting rcvhwm to 1 is not enough for that, since the message that is waiting in the queue goes stale
+ * while the consumer is busy, and the consumer still has to receive (and usually decode) every message.
+ *
+ * ZMQ_CONFLATE does the same thing inside ZMQ, but it does not support multipart messages.
+ * So pass single_part = true only if the publisher sends single-part messages. ZMQ then drops the stale messages
+ * before they even reach the receive thread. Otherwise, the receive thread drops them (which works for both modes).
+ */
+class ConflatingSubscriber {
+public:
+    using Frames = std::vector<::zmq::message_t>;
+
+    explicit ConflatingSubscriber(const std::string &endpoint, bool single_part = false)
+        : context(1), socket(context, ZMQ_SUB), running(true) {
+        if (single_part) {
+            socket.set(::zmq::sockopt::conflate, 1);
+        } else {
+            const int hwm = 1;  // set maximum queue length to 1 message
+            socket.set(::zmq::sockopt::rcvhwm, hwm);
+        }
+        // Wake up regularly, so that the receive thread notices when it should stop
+        const int receive_timeout_ms = 100;
+        socket.set(::zmq::sockopt::rcvtimeo, receive_timeout_ms);
+        socket.set(::zmq::sockopt::subscribe, "");
+        socket.connect(endpoint);
+        std::cout << "Subscribing to " << endpoint << std::endl;
+        receive_thread = std::thread(&ConflatingSubscriber::loop, this);
+    }
+
+    // Subscribe to topic on the device with the given IP address (see connectEndpoint)
+    ConflatingSubscriber(const Topic &topic, const std::string &ip, bool single_part = false)
+        : ConflatingSubscriber(connectEndpoint(ip, topic), single_part) {}
+
+    ConflatingSubscriber(const ConflatingSubscriber &) = delete;
+    ConflatingSubscriber &operator=(const ConflatingSubscriber &) = delete;
+
+    ~ConflatingSubscriber() {
+        {
+            std::lock_guard<std::mutex> lock(guard);
+            running = false;
+        }
+        message_available.notify_all();
+        if (receive_thread.joinable()) {
+            receive_thread.join();
+        }
+    }
+
+    /**
+     * Wait for a message that has not been taken yet, and take it.
+     * The frames can be viewed in place (e.g. with viewStampedImage, using the returned pointer as the owner),
+     * or reassembled and decoded.
+     * Returns nullptr if nothing arrived within the timeout, or if the subscriber is being destroyed.
+     */
+    std::shared_ptr<Frames> waitForNext(std::chrono::milliseconds timeout = std::chrono::milliseconds(100)) {
+        std::unique_lock<std::mutex> lock(guard);
+        message_available.wait_for(lock, timeout, [this] { return newest or not running; });
+        return std::move(newest);
+    }
+
+    /**
+     * Take the newest message like waitForNext, and decode it into data (with Data::read).
+     * Reusing the same data for every call avoids reallocating it.
+     * Returns false if nothing arrived within the timeout, or if the message was not of the expected type.
+     */
+    template <typename Data>
+    bool decodeNext(Data &data, std::chrono::milliseconds timeout = std::chrono::milliseconds(100)) {
+        const auto frames = waitForNext(timeout);
+        if (not frames) {
+            return false;
+        }
+        const auto msg = reassemble(*frames);
+        if (not detail::isExpectedMessage<Data>(msg, detail::HasGetInfo<Data>())) {
+            return false;
+        }
+        data.read(static_cast<const uint8_t *>(msg.data()));
+        return true;
+    }
+
+    [[nodiscard]] ConflatingSubscriberStats stats() const {
+        std::lock_guard<std::mutex> lock(guard);
+        return subscriber_stats;
+    }
+
+private:
+    ::zmq::context_t context;
+    ::zmq::socket_t socket;
+    mutable std::mutex guard;
+    std::condition_variable message_available;
+    bool running;
+    std::shared_ptr<Frames> newest;
+    ConflatingSubscriberStats subscriber_stats;
+    std::thread receive_thread;
+
+    void loop() {
+        auto frames = std::make_shared<Frames>();
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock(guard);
+                if (not running) {
+                    break;
+                }
+            }
+            try {
+                if (not recvFrames(socket, *frames)) {
+                    continue;
+                }
+            } catch (const ::zmq::error_t &error) {
+                if (error.num() == EINTR) {
+                    continue;
+                }
+                std::cerr << "Receiving a message failed: " << error.what() << std::endl;
+                break;
+            }
+            {
+                std::lock_guard<std::mutex> lock(guard);
+                ++subscriber_stats.received;
+                if (newest) {
+                    ++subscriber_stats.overwritten;
+                }
+                // Nobody else has seen the message that is replaced, so receive the next one into its vector
+                std::swap(newest, frames);
+            }
+            message_available.notify_all();
+            if (not frames) {
+                frames = std::make_shared<Frames>();
+            }
+        }
+    }
+};
+
+}  // namespace zmq
+}  // namespace nodar
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "topic_ports.hpp"
+
+namespace nodar {
+namespace zmq {
+
+/**
+ * How a subscriber reaches a publisher.
+ *
+ * A Publisher that binds on this device binds every transport that is available:
+ * tcp on all interfaces for remote subscribers, ipc://<ipcPath(port)> for subscribers on the same host,
+ * and inproc://<inprocName(port)> for subscribers in the same process (that share its ZMQ context).
+ * Subscribers then pick whichever one is cheapest with connectEndpoint.
+ */
+enum class Transport {
+    AUTO,  // IPC if the publisher is on this host and is listening on its ipc endpoint, and TCP otherwise
+    TCP,
+    IPC,  // Unix domain sockets. Not available on Windows.
+    INPROC,  // Only works between sockets of the same ZMQ context, e.g. PublisherExecutor::getContext()
+};
+
+/**
+ * The directory in which publishers create their ipc sockets.
+ * Set the NODAR_ZMQ_IPC_DIR environment variable to change it (e.g. when running in a container with a shared volume).
+ */
+inline std::string ipcDirectory() {
+    const auto dir = std::getenv("NODAR_ZMQ_IPC_DIR");
+    return dir ? dir : "/tmp";
+}
+
+inline std::string ipcPath(uint16_t port) { return ipcDirectory() + "/nodar_zmq_" + std::to_string(port) + ".ipc"; }
+
+inline std::string inprocName(uint16_t port) { return "nodar_zmq_" + std::to_string(port); }
+
+/**
+ * The transports that are enabled on this host.
+ * Set the NODAR_ZMQ_TRANSPORT environment variable to "tcp" to disable ipc in both publishers and subscribers,
+ * e.g. when the publisher and the subscribers are on the same host, but in different network namespaces.
+ */
+inline bool ipcEnabled() {
+#ifdef _WIN32
+    return false;
+#else
+    const auto transport = std::getenv("NODAR_ZMQ_TRANSPORT");
+    return not transport or std::string(transport) != "tcp";
+#endif
+}
+
+// The endpoints that a publisher binds on this device
+inline std::vector<std::string> bindEndpoints(uint16_t port) {
+    std::vector<std::string> endpoints{"tcp://*:" + std::to_string(port), "inproc://" + inprocName(port)};
+    if (ipcEnabled()) {
+        endpoints.push_back("ipc://" + ipcPath(port));
+    }
+    return endpoints;
+}
+
+inline bool isLocalHost(const std::string& ip) {
+    return ip.empty() or ip == "127.0.0.1" or ip == "localhost" or ip == "::1";
+}
+
+/**
+ * Whether a publisher is listening on an ipc socket at the given path.
+ * A publisher that crashed leaves its socket file behind, so the socket is probed with a connection
+ * (which is refused if nobody listens on it), rather than only checking that the file exists.
+ */
+inline bool ipcSocketExists(const std::string& path) {
+#ifdef _WIN32
+    return false;
+#else
+    struct stat info {};
+    if (stat(path.c_str(), &info) != 0 or not S_ISSOCK(info.st_mode)) {
+        return false;
+    }
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    const auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    const auto listening = ::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+    ::close(fd);
+    return listening;
+#endif
+}
+
+/**
+ * The endpoint that a subscriber should connect to, in order to reach the publisher of a port on the device with
+ * the given IP address. With Transport::AUTO, a subscriber on the same host as the publisher uses ipc,
+ * as long as the publisher is listening on its ipc socket, and everything else uses tcp.
+ */
+inline std::string connectEndpoint(const std::string& ip, uint16_t port, Transport transport = Transport::AUTO) {
+    if (transport == Transport::AUTO) {
+        const auto local = isLocalHost(ip) and ipcEnabled() and ipcSocketExists(ipcPath(port));
+        transport = local ? Transport::IPC : Transport::TCP;
+    }
+    switch (transport) {
+        case Transport::IPC:
+            return "ipc://" + ipcPath(port);
+        case Transport::INPROC:
+            return "inproc://" + inprocName(port);
+        default:
+            return "tcp://" + (ip.empty() ? std::string("127.0.0.1") : ip) + ":" + std::to_string(port);
+    }
+}
+
+inline std::string connectEndpoint(const std::string& ip, const Topic& topic, Transport transport = Transport::AUTO) {
+    return connectEndpoint(ip, topic.port, transport);
+}
+
+}  // namespace zmq
+}  // namespace nodar
@@ -0,0 +1,355 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace nodar {
+namespace zmq {
+
+/**
+ * A histogram of non-negative integers (e.g. durations in ns, or sizes in bytes) with fixed buckets,
+ * in the style of HdrHistogram. Every power of two is split into 16 linear sub-buckets,
+ * so every value from 0 up to 2^64 is recorded with a relative error of less than 1/16, in 976 buckets.
+ *
+ * Recording a value is two relaxed atomic increments, which never lock or allocate.
+ * Any thread can take a snapshot while another thread records, so the histogram can be left on in production.
+ */
+class Histogram {
+public:
+    static constexpr unsigned SUB_BUCKET_BITS = 4;
+    static constexpr uint64_t SUB_BUCKETS = uint64_t{1} << SUB_BUCKET_BITS;
+    static constexpr size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    // The counts of a histogram at one point in time
+    struct Snapshot {
+        std::array<uint64_t, BUCKET_COUNT> counts{};
+        uint64_t count{0};
+        uint64_t sum{0};
+
+        // The value below which the fraction p (between 0 and 1) of the values fall, up to the bucket resolution
+        [[nodiscard]] uint64_t percentile(double p) const {
+            if (count == 0) {
+                return 0;
+            }
+            const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(p * static_cast<double>(count) + 0.5));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+                seen += counts[i];
+                if (seen >= rank) {
+                    return upperBound(i);
+                }
+            }
+            return max();
+        }
+
+        [[nodiscard]] uint64_t max() const {
+            for (size_t i = BUCKET_COUNT; i > 0; --i) {
+                if (counts[i - 1] != 0) {
+                    return upperBound(i - 1);
+                }
+            }
+            return 0;
+        }
+
+        [[nodiscard]] double mean() const { return count == 0 ? 0.0 : static_cast<double>(sum) / count; }
+
+        // The values that were recorded between an earlier snapshot and this one
+        Snapshot operator-(const Snapshot &earlier) const {
+            Snapshot interval;
+            for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+                interval.counts[i] = counts[i] - earlier.counts[i];
+            }
+            interval.count = count - earlier.count;
+            interval.sum = sum - earlier.sum;
+            return interval;
+        }
+    };
+
+    void record(uint64_t value) {
+        counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        total_sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] Snapshot snapshot() const {
+        Snapshot result;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            result.counts[i] = counts[i].load(std::memory_order_relaxed);
+            result.count += result.counts[i];
+        }
+        result.sum = total_sum.load(std::memory_order_relaxed);
+        return result;
+    }
+
+    static size_t bucket(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        const unsigned shift = highestBit(value) - SUB_BUCKET_BITS;
+        return static_cast<size_t>((shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS));
+    }
+
+    // The largest value that falls into a bucket
+    static uint64_t upperBound(size_t index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        const auto shift = static_cast<unsigned>(index / SUB_BUCKETS - 1);
+        const uint64_t mantissa = SUB_BUCKETS + index % SUB_BUCKETS;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> counts{};
+    std::atomic<uint64_t> total_sum{0};
+
+    static unsigned highestBit(uint64_t value) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<unsigned>(index);
+#else
+        return 63 - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+    }
+};
+
+/**
+ * Receive statistics of one topic: dropped frames (gaps in the frame IDs), inter-arrival times,
+ * end-to-end latencies (the receive time minus the time stamp of the message) and message sizes.
+ *
+ * Call record() from the thread that receives the messages (one thread per FrameStats).
+ * Everything is kept in atomics and fixed-size histograms, so recording is cheap, and summary() can be called
+ * from any thread at any time, e.g. by a FrameStatsReporter.
+ *
+ * The latency is only meaningful if the clocks of the publisher and the subscriber agree, i.e. if they run on the same
+ * host, if their clocks are synchronized (e.g. with PTP), or if the offset between them is estimated with a
+ * ClockSyncClient (see setClockOffset). Messages that appear to come from the future are counted as clock_skewed.
+ */
+class FrameStats {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Summary {
+        std::string name;
+        double seconds{0.0};  // The time that the summary covers
+        uint64_t received{0};  // Number of messages received
+        uint64_t dropped{0};  // Number of frame IDs that never arrived
+        uint64_t out_of_order{0};  // Number of messages whose frame ID was not larger than that of the previous one
+        uint64_t clock_skewed{0};  // Number of messages whose time stamp was later than the time they were received
+        Histogram::Snapshot inter_arrival_ns;
+        Histogram::Snapshot latency_ns;
+        Histogram::Snapshot size_bytes;
+        Clock::time_point taken;
+
+        // What happened between an earlier summary of the same topic and this one
+        Summary operator-(const Summary &earlier) const {
+            Summary interval;
+            interval.name = name;
+            interval.seconds = std::chrono::duration<double>(taken - earlier.taken).count();
+            interval.received = received - earlier.received;
+            interval.dropped = dropped - earlier.dropped;
+            interval.out_of_order = out_of_order - earlier.out_of_order;
+            interval.clock_skewed = clock_skewed - earlier.clock_skewed;
+            interval.inter_arrival_ns = inter_arrival_ns - earlier.inter_arrival_ns;
+            interval.latency_ns = latency_ns - earlier.latency_ns;
+            interval.size_bytes = size_bytes - earlier.size_bytes;
+            interval.taken = taken;
+            return interval;
+        }
+
+        [[nodiscard]] double rate() const { return seconds > 0.0 ? received / seconds : 0.0; }
+
+        // One line, e.g. "nodar/disparity: 10.0 Hz, 300 msgs, 2 dropped | inter-arrival ms p50 ... | latency ms ..."
+        void print(std::ostream &out) const {
+            const auto ms = [](uint64_t ns) { return ns / 1e6; };
+            const auto flags = out.flags();
+            const auto precision = out.precision();
+            out << std::fixed << std::setprecision(1) << name << ": " << rate() << " Hz, " << received << " msgs, "
+                << dropped << " dropped";
+            if (out_of_order != 0) {
+                out << ", " << out_of_order << " out of order";
+            }
+            if (received != 0) {
+                out << std::setprecision(2)  //
+                    << " | inter-arrival ms p50 " << ms(inter_arrival_ns.percentile(0.5))  //
+                    << " p99 " << ms(inter_arrival_ns.percentile(0.99))  //
+                    << " max " << ms(inter_arrival_ns.max())  //
+                    << " | latency ms p50 " << ms(latency_ns.percentile(0.5))  //
+                    << " p99 " << ms(latency_ns.percentile(0.99))  //
+                    << " max " << ms(latency_ns.max())  //
+                    << " | size KB mean " << size_bytes.mean() / 1024;
+            }
+            if (clock_skewed != 0) {
+                out << " (" << clock_skewed << " time stamps were in the future; are the clocks synchronized?)";
+            }
+            out << std::endl;
+            out.flags(flags);
+            out.precision(precision);
+        }
+    };
+
+    explicit FrameStats(std::string name = "") : topic_name(std::move(name)) {}
+
+    FrameStats(const FrameStats &) = delete;
+    FrameStats &operator=(const FrameStats &) = delete;
+
+    /**
+     * Record a message with the given frame ID, time stamp (ns since the epoch of the system clock), and size.
+     * Returns the number of frames that were dropped between the previous message and this one.
+     */
+    uint64_t record(uint64_t frame_id, uint64_t time, size_t bytes) {
+        const auto arrival = Clock::now();
+        const auto now = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch())
+                .count());
+        uint64_t skipped = 0;
+        const auto last = last_frame_id.load(std::memory_order_relaxed);
+        if (received.load(std::memory_order_relaxed) == 0) {
+            first_arrival.store(arrival.time_since_epoch().count(), std::memory_order_relaxed);
+        } else {
+            if (frame_id > last + 1) {
+                skipped = frame_id - last - 1;
+                dropped.fetch_add(skipped, std::memory_order_relaxed);
+            } else if (frame_id <= last) {
+                out_of_order.fetch_add(1, std::memory_order_relaxed);
+            }
+            const Clock::time_point previous_arrival(Clock::duration(last_arrival.load(std::memory_order_relaxed)));
+            const auto since_last = arrival - previous_arrival;
+            inter_arrival.record(static_cast<uint64_t>(
+                std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(since_last).count(), 0)));
+        }
+        last_frame_id.store(frame_id, std::memory_order_relaxed);
+        last_arrival.store(arrival.time_since_epoch().count(), std::memory_order_relaxed);
+        if (time != 0) {
+            // Convert the time stamp from the clock of the publisher to the clock of this host
+            const auto offset = clock_offset ? clock_offset->load(std::memory_order_relaxed) : 0;
+            time -= static_cast<uint64_t>(offset);
+        }
+        if (time > now) {
+            clock_skewed.fetch_add(1, std::memory_order_relaxed);
+        } else if (time != 0) {
+            latency.record(now - time);
+        }
+        size.record(bytes);
+        received.fetch_add(1, std::memory_order_relaxed);
+        return skipped;
+    }
+
+    // Record a message that has a frame_id and a time, e.g. a StampedImage or a view of one
+    template <typename Message>
+    uint64_t record(const Message &message, size_t bytes) {
+        return record(message.frame_id, message.time, bytes);
+    }
+
+    /**
+     * Correct the time stamps by the offset of the clock of the publisher (its clock minus the clock of this host),
+     * e.g. ClockSyncClient::offset(), which must outlive this FrameStats.
+     */
+    void setClockOffset(const std::atomic<int64_t> &offset_ns) { clock_offset = &offset_ns; }
+
+    [[nodiscard]] const std::string &name() const { return topic_name; }
+
+    // Everything since the first message
+    [[nodiscard]] Summary summary() const {
+        Summary result;
+        result.name = topic_name;
+        result.taken = Clock::now();
+        result.received = received.load(std::memory_order_relaxed);
+        if (result.received != 0) {
+            const Clock::time_point first(Clock::duration(first_arrival.load(std::memory_order_relaxed)));
+            result.seconds = std::chrono::duration<double>(result.taken - first).count();
+        }
+        result.dropped = dropped.load(std::memory_order_relaxed);
+        result.out_of_order = out_of_order.load(std::memory_order_relaxed);
+        result.clock_skewed = clock_skewed.load(std::memory_order_relaxed);
+        result.inter_arrival_ns = inter_arrival.snapshot();
+        result.latency_ns = latency.snapshot();
+        result.size_bytes = size.snapshot();
+        return result;
+    }
+
+private:
+    const std::string topic_name;
+    std::atomic<uint64_t> received{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> out_of_order{0};
+    std::atomic<uint64_t> clock_skewed{0};
+    std::atomic<uint64_t> last_frame_id{0};
+    std::atomic<Clock::rep> first_arrival{0};
+    std::atomic<Clock::rep> last_arrival{0};
+    Histogram inter_arrival;
+    Histogram latency;
+    Histogram size;
+    const std::atomic<int64_t> *clock_offset = nullptr;
+};
+
+/**
+ * Print a summary of every added FrameStats, for the interval since the previous one, every period.
+ * The summaries are printed from a background thread, so the receive threads never wait for the output.
+ */
+class FrameStatsReporter {
+public:
+    explicit FrameStatsReporter(std::chrono::milliseconds period_arg, std::ostream &out_arg = std::cout)
+        : period(period_arg), out(out_arg), running(true), report_thread(&FrameStatsReporter::loop, this) {}
+
+    FrameStatsReporter(const FrameStatsReporter &) = delete;
+    FrameStatsReporter &operator=(const FrameStatsReporter &) = delete;
+
+    ~FrameStatsReporter() {
+        {
+            std::lock_guard<std::mutex> lock(guard);
+            running = false;
+        }
+        wake.notify_all();
+        report_thread.join();
+    }
+
+    // The stats must outlive this reporter
+    void add(const FrameStats &stats) {
+        std::lock_guard<std::mutex> lock(guard);
+        reported.push_back({&stats, stats.summary()});
+    }
+
+private:
+    struct Reported {
+        const FrameStats *stats;
+        FrameStats::Summary previous;
+    };
+
+    const std::chrono::milliseconds period;
+    std::ostream &out;
+    std::mutex guard;
+    std::condition_variable wake;
+    bool running;
+    std::vector<Reported> reported;
+    std::thread report_thread;
+
+    void loop() {
+        std::unique_lock<std::mutex> lock(guard);
+        while (not wake.wait_for(lock, period, [this] { return not running; })) {
+            for (auto &topic : reported) {
+                auto current = topic.stats->summary();
+                (current - topic.previous).print(out);
+                topic.previous = std::move(current);
+            }
+        }
+    }
+};
+
+}  // namespace zmq
+}  // namespace nodar
@@ -1,14 +1,19 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
+#include <memory>
 #include <vector>
 
 #include "message_info.hpp"
+#include "span.hpp"
 #include "utils.hpp"
 
 namespace nodar {
 namespace zmq {
 
+struct StampedImageView;
+
 struct StampedImage {
     enum COLOR_CONVERSION : uint8_t { BGR2BGR = 253, INCONVERTIBLE = 254, UNSPECIFIED = 255 };
 
@@ -61,7 +66,17 @@ struct StampedImage {
           additional_field_size{0},
           additional_field{} {}
 
-    explicit StampedImage(const uint8_t *src) {
+    explicit StampedImage(const StampedImageView &view);
+
+    explicit StampedImage(const uint8_t *src) { read(src); }
+
+    /**
+     * Decode a message into this image.
+     * The image data and the additional field reuse the capacity of this image, so that decoding a stream of
+     * same-sized images into one StampedImage does not allocate after the first one.
+     * If the message is invalid, then the image is left empty (rather than keeping the previous image).
+     */
+    void read(const uint8_t *src) {
         // The message has a header, followed by the image data
         auto header = src;
         const auto data = header + HEADER_SIZE;
@@ -71,6 +86,7 @@ struct StampedImage {
         header = utils::read(header, info);
         if (info != INFO) {
             std::cerr << "This message either is not an image message, or is a different message version." << std::endl;
+            clear();
             return;
         }
         header = utils::read(header, time);
@@ -79,30 +95,27 @@ struct StampedImage {
         // Read the image size to make sure that it is something plausible
         header = utils::read(header, rows);
         header = utils::read(header, cols);
-        if (rows * cols > 1e8) {
+        if (static_cast<uint64_t>(rows) * cols > 1e8) {
             std::cerr << "According to the message, the image has the impossibly large of dimensions " << rows << " x "
                       << cols << ". We are ignoring this message so that you don't run out of memory." << std::endl;
+            clear();
             return;
         }
         header = utils::read(header, type);
         header = utils::read(header, cvt_to_bgr_code);
         header = utils::read(header, additional_field_size);
-
-        // Copy the image data
-        const auto image_data_size = StampedImage::dataSize(rows, cols, type, 0);
-        img = std::vector<uint8_t>(data, data + image_data_size);
-
         if (additional_field_size > 1024) {
             std::cerr << "According to the message, the additional field has exceeded the maximum size of 1024 bytes. "
                       << "We are ignoring this message so that you don't run out of memory." << std::endl;
-        } else if (additional_field_size > 0) {
-            // Copy the additional field, if it exists
-            const auto additional_data = data + image_data_size;
-            additional_field = std::vector<uint8_t>(additional_data, additional_data + additional_field_size);
-        } else {
-            // initialize an empty additional field
-            additional_field = std::vector<uint8_t>();
+            clear();
+            return;
         }
+
+        // Copy the image data, and the additional field, if it exists
+        const auto image_data_size = StampedImage::dataSize(rows, cols, type, 0);
+        img.assign(data, data + image_data_size);
+        const auto additional_data = data + image_data_size;
+        additional_field.assign(additional_data, additional_data + additional_field_size);
     }
 
     [[nodiscard]] static constexpr uint32_t channels(uint32_t type_) {
@@ -128,7 +141,7 @@ struct StampedImage {
 
     [[nodiscard]] static constexpr uint64_t dataSize(uint32_t rows_, uint32_t cols_, uint32_t type_,
                                                      uint16_t additional_field_size_) {
-        return rows_ * cols_ * channels(type_) * elemSize(type_) + additional_field_size_;
+        return static_cast<uint64_t>(rows_) * cols_ * channels(type_) * elemSize(type_) + additional_field_size_;
     }
 
     [[nodiscard]] static constexpr uint64_t msgSize(uint32_t rows_, uint32_t cols_, uint32_t type_, //
@@ -283,7 +296,181 @@ struct StampedImage {
         return write(dst, time, frame_id, rows, cols, type, cvt_to_bgr_code, img.data(), additional_field_size,
                      additional_field.data());
     }
+
+private:
+    // Leave the image empty, keeping the capacity of its buffers
+    void clear() {
+        rows = 0;
+        cols = 0;
+        additional_field_size = 0;
+        img.clear();
+        additional_field.clear();
+    }
 };
 
+/**
+ * A non-owning view of a serialized StampedImage.
+ * The header is parsed in place, and the image data and the additional field are exposed as spans into the message,
+ * so constructing a view never copies any pixels.
+ *
+ * The spans are only valid for as long as the underlying message is alive.
+ * If the view is constructed from a std::shared_ptr (for example, a std::shared_ptr<::zmq::message_t>),
+ * then the view shares ownership of the message, and the spans remain valid for the lifetime of the view
+ * (and of any copies of it). Otherwise, it is up to the caller to keep the message alive.
+ *
+ * If the message is invalid, then an error is printed and the view is empty.
+ */
+struct StampedImageView {
+    uint64_t time{};
+    uint64_t frame_id{};
+    uint32_t rows{};
+    uint32_t cols{};
+    uint32_t type{};
+    uint8_t cvt_to_bgr_code{StampedImage::UNSPECIFIED};
+    uint16_t additional_field_size{0};
+    Span<const uint8_t> img;
+    Span<const uint8_t> additional_field;
+    // Keeps the underlying message alive (if the view was constructed with an owner)
+    std::shared_ptr<const void> owner;
+
+    StampedImageView() = default;
+
+    StampedImageView(const uint8_t *src, uint64_t size, std::shared_ptr<const void> owner_arg = nullptr)
+        : owner(std::move(owner_arg)) {
+        // The message has a header, followed by the image data
+        if (not readHeader(src, size)) {
+            return;
+        }
+        const auto data = src + StampedImage::HEADER_SIZE;
+        const auto image_data_size = StampedImage::dataSize(rows, cols, type, 0);
+        if (size < StampedImage::HEADER_SIZE + image_data_size + additional_field_size) {
+            std::cerr << "The image message is truncated. Expected " << msgSize() << " bytes, but got " << size
+                      << " bytes." << std::endl;
+            *this = StampedImageView();
+            return;
+        }
+        img = Span<const uint8_t>(data, image_data_size);
+        additional_field = Span<const uint8_t>(data + image_data_size, additional_field_size);
+    }
+
+    /**
+     * Construct a view over an image whose header, image data, and additional field live in separate blocks of memory,
+     * for example, the frames of a multipart message (see multipart.hpp).
+     * If additional_field_arg is empty, then the additional field (if any) is expected directly after the image data.
+     */
+    StampedImageView(Span<const uint8_t> header,  //
+                     Span<const uint8_t> img_arg,  //
+                     Span<const uint8_t> additional_field_arg,  //
+                     std::shared_ptr<const void> owner_arg = nullptr)
+        : owner(std::move(owner_arg)) {
+        if (not readHeader(header.data(), header.size())) {
+            return;
+        }
+        const auto image_data_size = StampedImage::dataSize(rows, cols, type, 0);
+        if (additional_field_arg.empty() and additional_field_size > 0) {
+            additional_field_arg = Span<const uint8_t>(img_arg.data() + image_data_size,
+                                                       img_arg.size() - std::min(img_arg.size(), image_data_size));
+        }
+        if (img_arg.size() < image_data_size or additional_field_arg.size() < additional_field_size) {
+            std::cerr << "The image message is truncated. Expected " << image_data_size << " bytes of image data and "
+                      << additional_field_size << " bytes of additional field, but got " << img_arg.size() << " and "
+                      << additional_field_arg.size() << " bytes." << std::endl;
+            *this = StampedImageView();
+            return;
+        }
+        img = Span<const uint8_t>(img_arg.data(), image_data_size);
+        additional_field = Span<const uint8_t>(additional_field_arg.data(), additional_field_size);
+    }
+
+    /**
+     * Construct a view that shares ownership of a message, e.g. a std::shared_ptr<::zmq::message_t>.
+     * Any type with data() and size() methods works.
+     */
+    template <typename Message>
+    explicit StampedImageView(const std::shared_ptr<Message> &msg)
+        : StampedImageView(static_cast<const uint8_t *>(msg->data()), msg->size(), msg) {}
+
+    [[nodiscard]] bool empty() const { return rows == 0 || cols == 0; }
+
+    [[nodiscard]] uint32_t channels() const { return StampedImage::channels(type); }
+
+    [[nodiscard]] uint32_t depthType() const { return StampedImage::depthType(type); }
+
+    [[nodiscard]] uint32_t elemSize() const { return StampedImage::elemSize(type); }
+
+    [[nodiscard]] uint64_t dataSize() const {
+        return StampedImage::dataSize(rows, cols, type, additional_field_size);
+    }
+
+    [[nodiscard]] uint64_t additionalFieldSize() const { return additional_field.size(); }
+
+    [[nodiscard]] uint64_t msgSize() const {
+        return StampedImage::msgSize(rows, cols, type, additional_field_size);
+    }
+
+private:
+    // Decode and validate the header. The spans are left empty.
+    bool readHeader(const uint8_t *header, uint64_t size) {
+        if (size < StampedImage::HEADER_SIZE) {
+            std::cerr << "This message is too small to be an image message." << std::endl;
+            return false;
+        }
+
+        // Check the info to make sure this message is the type we expect
+        MessageInfo info;
+        header = utils::read(header, info);
+        if (info != StampedImage::getInfo()) {
+            std::cerr << "This message either is not an image message, or is a different message version." << std::endl;
+            return false;
+        }
+        uint64_t time_;
+        uint64_t frame_id_;
+        uint32_t rows_;
+        uint32_t cols_;
+        uint32_t type_;
+        uint8_t cvt_to_bgr_code_;
+        uint16_t additional_field_size_;
+        header = utils::read(header, time_);
+        header = utils::read(header, frame_id_);
+        header = utils::read(header, rows_);
+        header = utils::read(header, cols_);
+        header = utils::read(header, type_);
+        header = utils::read(header, cvt_to_bgr_code_);
+        header = utils::read(header, additional_field_size_);
+
+        // Make sure that the sizes are plausible
+        if (static_cast<uint64_t>(rows_) * cols_ > 1e8) {
+            std::cerr << "According to the message, the image has the impossibly large of dimensions " << rows_
+                      << " x " << cols_ << ". We are ignoring this message." << std::endl;
+            return false;
+        }
+        if (additional_field_size_ > 1024) {
+            std::cerr << "According to the message, the additional field has exceeded the maximum size of 1024 bytes. "
+                      << "We are ignoring this message." << std::endl;
+            return false;
+        }
+
+        time = time_;
+        frame_id = frame_id_;
+        rows = rows_;
+        cols = cols_;
+        type = type_;
+        cvt_to_bgr_code = cvt_to_bgr_code_;
+        additional_field_size = additional_field_size_;
+        return true;
+    }
+};
+
+inline StampedImage::StampedImage(const StampedImageView &view)
+    : time(view.time),
+      frame_id(view.frame_id),
+      rows(view.rows),
+      cols(view.cols),
+      type(view.type),
+      cvt_to_bgr_code(view.cvt_to_bgr_code),
+      additional_field_size(view.additional_field_size),
+      img(view.img.begin(), view.img.end()),
+      additional_field(view.additional_field.begin(), view.additional_field.end()) {}
+
 }  // namespace zmq
 }  // namespace nodar
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <nodar/zmq/topic_ports.hpp>
+#include <string>
+#include <vector>
+
+#include "publisher_executor.hpp"
+#include "relay.hpp"
+
+namespace nodar {
+namespace zmq {
+
+/**
+ * A Relay that keeps the last message of every topic, and sends it to every new subscriber as soon as it subscribes,
+ * so that a subscriber that (re)starts has a valid state right away, rather than after the next publication.
+ * This is meant for topics that describe a state, and are published slowly or only when it changes,
+ * e.g. OCCUPANCY_MAP_TOPIC, QA_FINDINGS_TOPIC, or the NAVIGATION_TOPIC of a NavigationPublisher on this host.
+ *
+ * Use it like a Relay: it subscribes to the topics on the device with the given IP address (or on this host),
+ * and re-publishes them on the port of each topic plus port_offset. Subscribers connect to it instead.
+ *
+ * New subscribers are detected with the subscription notifications of the XPUB socket of each topic.
+ * An XPUB socket cannot send to a single subscriber, so the subscribers that already got the last message get it
+ * again whenever another subscriber joins. So subscribers should expect to see the same frame_id twice.
+ * The last message is kept as the frames that were received, which share their data with the frames that were
+ * re-published, so keeping it does not copy it.
+ */
+class LastValueCache : public Relay {
+public:
+    LastValueCache(const std::vector<Topic> &topics, const std::string &ip, int queue_depth = 1,
+                   uint16_t port_offset = 0, bool local_only = false)
+        : Relay(topics, ip, std::unique_ptr<PublisherExecutor>(new PublisherExecutor()), nullptr, queue_depth,
+                port_offset, local_only, true) {}
+
+    // Like the constructor above, but use the ZMQ context of an executor, which must outlive this cache
+    LastValueCache(const std::vector<Topic> &topics, const std::string &ip, PublisherExecutor &executor,
+                   int queue_depth = 1, uint16_t port_offset = 0, bool local_only = false)
+        : Relay(topics, ip, nullptr, &executor, queue_depth, port_offset, local_only, true) {}
+};
+
+}  // namespace zmq
+}  // namespace nodar
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <zmq.hpp>
+
+#include "buffer_pool.hpp"
+#include "image.hpp"
+#include "point_cloud_soup.hpp"
+#include "span.hpp"
+
+namespace nodar {
+namespace zmq {
+
+/**
+ * One frame of a multipart message.
+ *
+ * In the multipart wire mode, a message is split into header frames and payload frames,
+ * where each payload frame points directly at memory owned by the producer, so that large payloads
+ * (e.g. the pixels of an image) never have to be serialized into one contiguous buffer.
+ * Concatenating the frames of a message always gives exactly the single-part encoding of that message.
+ * So a subscriber can either reassemble the frames (see reassemble), or view them in place (see viewStampedImage and
+ * viewPointCloudSoup).
+ *
+ * The memory of a frame is handed to ZMQ without being copied (https://linux.die.net/man/3/zmq_msg_init_data),
+ * so it must remain valid and unmodified until release is called. Note that ZMQ may call release from its I/O thread.
+ * If release is nullptr, then you are responsible for keeping the memory alive until the message has been sent.
+ */
+struct Frame {
+    // This is the signature that is used by ZMQ, see zmq_free_fn
+    using ReleaseFunction = void (*)(void *data, void *hint);
+
+    const void *data = nullptr;
+    size_t size = 0;
+    ReleaseFunction release = nullptr;
+    void *hint = nullptr;
+
+    Frame() = default;
+
+    Frame(const void *data_arg, size_t size_arg, ReleaseFunction release_arg = nullptr, void *hint_arg = nullptr)
+        : data(data_arg), size(size_arg), release(release_arg), hint(hint_arg) {}
+
+    // A frame around a buffer, which is returned to its pool once it has been sent
+    explicit Frame(Buffer *buffer) : Frame(buffer->data(), buffer->size(), Buffer::release, buffer) {}
+
+    // Release the memory without sending it
+    void discard() const {
+        if (release) {
+            release(const_cast<void *>(data), hint);
+        }
+    }
+};
+
+namespace multipart {
+
+/**
+ * Write the header frame of a multipart StampedImage into a buffer.
+ * The frames of the message are {header, image data} or {header, image data, additional field}.
+ */
+inline Frame writeStampedImageHeader(Buffer *buffer,  //
+                                     uint64_t time,  //
+                                     uint64_t frame_id,  //
+                                     uint32_t rows,  //
+                                     uint32_t cols,  //
+                                     uint32_t type,  //
+                                     uint8_t cvt_to_bgr_code,  //
+                                     uint16_t additional_field_size) {
+    buffer->resize(StampedImage::HEADER_SIZE);
+    StampedImage::write_header(buffer->data(), time, frame_id, rows, cols, type, cvt_to_bgr_code,
+                               additional_field_size);
+    return Frame(buffer);
+}
+
+/**
+ * Write the two header frames of a multipart PointCloudSoup into two buffers.
+ * The first holds the soup header followed by the header of the rectified image,
+ * and the second holds the header of the disparity image.
+ * The frames of the message are {soup_header, rectified image data, disparity_header, disparity image data}.
+ */
+inline void writePointCloudSoupHeaders(Buffer *soup_header,  //
+                                       Buffer *disparity_header,  //
+                                       uint64_t time,  //
+                                       uint64_t frame_id,  //
+                                       double baseline,  //
+                                       double focal_length,  //
+                                       const std::array<float, 16> &disparity_to_depth4x4,  //
+                                       const std::array<float, 9> &rotation_disparity_to_raw_cam,  //
+                                       const std::array<float, 9> &rotation_world_to_raw_cam,  //
+                                       uint32_t rows,  //
+                                       uint32_t cols,  //
+                                       uint32_t rectified_type,  //
+                                       uint32_t disparity_type) {
+    soup_header->resize(PointCloudSoup::HEADER_SIZE + StampedImage::HEADER_SIZE);
+    auto dst = PointCloudSoup::write_header(soup_header->data(), time, frame_id, baseline, focal_length,
+                                            disparity_to_depth4x4, rotation_disparity_to_raw_cam,
+                                            rotation_world_to_raw_cam, rows, cols);
+    StampedImage::write_header(dst, time, frame_id, rows, cols, rectified_type, 0);
+    disparity_header->resize(StampedImage::HEADER_SIZE);
+    StampedImage::write_header(disparity_header->data(), time, frame_id, rows, cols, disparity_type, 0);
+}
+
+}  // namespace multipart
+
+/**
+ * Receive all the frames of the next message.
+ * A single-part message gives exactly one frame, so this works with both wire modes.
+ * Returns false, and leaves frames empty, if nothing was received (e.g. because of a timeout or recv_flags::dontwait).
+ */
+inline bool recvFrames(::zmq::socket_t &socket, std::vector<::zmq::message_t> &frames,
+                       ::zmq::recv_flags flags = ::zmq::recv_flags::none) {
+    frames.clear();
+    do {
+        frames.emplace_back();
+        // ZMQ delivers multipart messages atomically, so only the first frame can be missing
+        const auto received = socket.recv(frames.back(), frames.size() == 1 ? flags : ::zmq::recv_flags::none);
+        if (not received) {
+            frames.clear();
+            return false;
+        }
+    } while (frames.back().more());
+    return true;
+}
+
+/**
+ * Concatenate the frames of a message into one message with the single-part layout.
+ * If there is only one frame, then it is moved rather than copied.
+ */
+inline ::zmq::message_t reassemble(std::vector<::zmq::message_t> &frames) {
+    if (frames.size() == 1) {
+        return std::move(frames.front());
+    }
+    size_t size = 0;
+    for (const auto &frame : frames) {
+        size += frame.size();
+    }
+    ::zmq::message_t msg(size);
+    auto dst = static_cast<uint8_t *>(msg.data());
+    for (const auto &frame : frames) {
+        memcpy(dst, frame.data(), frame.size());
+        dst += frame.size();
+    }
+    return msg;
+}
+
+/**
+ * View a StampedImage in place, whether it was received as a single frame or as multiple frames.
+ * Pass an owner (e.g. the std::shared_ptr that holds frames) to keep the frames alive for as long as the view.
+ */
+inline StampedImageView viewStampedImage(const std::vector<::zmq::message_t> &frames,
+                                         std::shared_ptr<const void> owner = nullptr) {
+    const auto span = [&frames](size_t i) {
+        if (i >= frames.size()) {
+            return Span<const uint8_t>();
+        }
+        return Span<const uint8_t>(static_cast<const uint8_t *>(frames[i].data()), frames[i].size());
+    };
+    if (frames.size() == 1) {
+        return {span(0).data(), span(0).size(), std::move(owner)};
+    }
+    if (frames.size() > 3) {
+        std::cerr << "A multipart image message should have at most 3 frames, but this one has " << frames.size()
+                  << " frames." << std::endl;
+        return {};
+    }
+    return {span(0), span(1), span(2), std::move(owner)};
+}
+
+/**
+ * View a PointCloudSoup in place, whether it was received as a single frame or as the four frames that
+ * multipart::writePointCloudSoupHeaders describes.
+ * Pass an owner (e.g. the std::shared_ptr that holds frames) to keep the frames alive for as long as the view.
+ */
+inline PointCloudSoupView viewPointCloudSoup(const std::vector<::zmq::message_t> &frames,
+                                             std::shared_ptr<const void> owner = nullptr) {
+    const auto span = [&frames](size_t i) {
+        return Span<const uint8_t>(static_cast<const uint8_t *>(frames[i].data()), frames[i].size());
+    };
+    if (frames.size() == 1) {
+        return {span(0).data(), span(0).size(), std::move(owner)};
+    }
+    if (frames.size() != 4) {
+        std::cerr << "A multipart PointCloudSoup message should have 4 frames, but this one has " << frames.size()
+                  << " frames." << std::endl;
+        return {};
+    }
+    return {span(0), span(1), span(2), span(3), std::move(owner)};
+}
+
+}  // namespace zmq
+}  // namespace nodar
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstring>
+#include <iostream>
+#include <nodar/zmq/topic_ports.hpp>
+#include <string>
+#include <vector>
+#include <zmq.hpp>
+
+#include "endpoint.hpp"
+#include "publisher_executor.hpp"
+
+namespace nodar {
+namespace zmq {
+
+/**
+ * The routing frame that leads every message of a topic on a multiplexed socket, and the prefix that a subscriber
+ * subscribes to in order to get exactly that topic. This is the name of the topic including its terminating null,
+ * so that e.g. nodar/point_cloud does not also match nodar/point_cloud_rgb.
+ */
+inline std::string routingFrame(const Topic &topic) { return std::string(topic.name, std::strlen(topic.name) + 1); }
+
+/**
+ * One PUB socket that many publishers share, so that many topics are published on a single port.
+ *
+ * By default, every Publisher binds its own socket on the port of its topic, so the number of ports (and firewall
+ * rules, connections and socket buffers) grows with the number of topics. A Publisher that is given a multiplexer
+ * instead sends every message on the socket of the multiplexer, behind a routing frame (see routingFrame).
+ * A subscriber connects to the port of the multiplexer, and subscribes to the routing frames of the topics that it
+ * wants, so ZMQ only sends it those topics, over one connection, e.g.
+ *
+ *     nodar::zmq::PublisherExecutor executor;
+ *     nodar::zmq::Multiplexer multiplexer(executor);
+ *     nodar::zmq::Publisher<ObstacleData> obstacles(OBSTACLE_TOPIC, multiplexer);
+ *     nodar::zmq::Publisher<QAFindings> findings(QA_FINDINGS_TOPIC, multiplexer);
+ *
+ *     nodar::zmq::Subscriber<ObstacleData> subscriber(OBSTACLE_TOPIC, ip, nodar::zmq::MULTIPLEXED);
+ *
+ * (or subscribe to several topics over one connection with TopicLoop::subscribeMultiplexed).
+ *
+ * The socket is only ever used by the sender thread of the executor, so the publishers need no extra locking.
+ * The high water mark applies to the whole stream of each subscriber, so it should leave room for a message of
+ * every topic. The multiplexer must outlive its publishers, and the executor must outlive the multiplexer.
+ * The socket may still hold messages of a publisher that is gone, but their buffers keep the pool of that publisher
+ * alive until ZMQ releases them (see BufferPool::lend).
+ */
+class Multiplexer {
+public:
+    explicit Multiplexer(PublisherExecutor &executor_arg, uint16_t port = MULTIPLEXED_TOPIC.port,
+                         int queue_depth = 16)
+        : executor(executor_arg), socket(executor.getContext(), ZMQ_PUB) {
+        socket.set(::zmq::sockopt::sndhwm, queue_depth);
+        for (const auto &endpoint : bindEndpoints(port)) {
+            std::cout << "Binding multiplexed publisher on the endpoint " << endpoint << std::endl;
+            socket.bind(endpoint);
+        }
+    }
+
+    Multiplexer(const Multiplexer &) = delete;
+    Multiplexer &operator=(const Multiplexer &) = delete;
+
+    PublisherExecutor &getExecutor() { return executor; }
+
+    // Only use this from the sender thread of the executor (i.e. from QueuedSender::sendNext)
+    ::zmq::socket_t &getSocket() { return socket; }
+
+private:
+    PublisherExecutor &executor;
+    ::zmq::socket_t socket;
+};
+
+// Pass this to a Subscriber to receive its topic from a Multiplexer
+struct Multiplexed {};
+constexpr Multiplexed MULTIPLEXED{};
+
+}  // namespace zmq
+}  // namespace nodar
@@ -1,10 +1,12 @@
 #pragma once
 
 #include <iostream>
+#include <memory>
 #include <utility>
 #include <vector>
 
 #include "nodar/zmq/message_info.hpp"
+#include "nodar/zmq/span.hpp"
 #include "nodar/zmq/utils.hpp"
 
 namespace nodar {
@@ -18,6 +20,8 @@ struct Point {
 
 static_assert(sizeof(Point) == 12, "The Point class is assumed to be non-padded.");
 
+struct PointCloudView;
+
 struct PointCloud {
     static constexpr uint64_t HEADER_SIZE = 512;
     static constexpr MessageInfo getInfo() { return MessageInfo(4); }
@@ -43,6 +47,8 @@ struct PointCloud {
 
     explicit PointCloud(const uint8_t *src) { read(src); }
 
+    explicit PointCloud(const PointCloudView &view);
+
     [[nodiscard]] static constexpr uint64_t pointCloudBytes(uint64_t num_points_) {
         return num_points_ * sizeof(Point);
     }
@@ -61,8 +67,8 @@ struct PointCloud {
         time = time_;
         frame_id = frame_id_;
         num_points = num_points_;
-        points.resize(num_points_);
-        memcpy(points.data(), point_data_, pointCloudBytes());
+        const auto begin = reinterpret_cast<const Point *>(point_data_);
+        points.assign(begin, begin + num_points_);
     }
 
     void read(const uint8_t *src) {
@@ -82,19 +88,35 @@ struct PointCloud {
         src = utils::read(src, frame_id);
         src = utils::read(src, num_points);
 
-        // Read the point cloud
-        points.resize(num_points);
-        memcpy(points.data(), point_mem, pointCloudBytes());
+        // Read the point cloud.
+        // assign (rather than resize + memcpy) reuses the existing capacity and copies each point exactly once.
+        const auto begin = reinterpret_cast<const Point *>(point_mem);
+        points.assign(begin, begin + num_points);
     }
 
-    static auto write(uint8_t *dst, uint64_t time_, uint64_t frame_id_, uint64_t num_points_,
-                      const float *point_data_) {
-        auto point_mem = dst + HEADER_SIZE;
+    /**
+     * Read a message of the given size into this object, reusing the capacity of points from previous reads.
+     * Unlike read, the message size is validated before anything is copied.
+     * If the message is invalid, then an error is printed and the point cloud is cleared.
+     * Returns false if the resulting point cloud is empty.
+     */
+    bool read_into(const uint8_t *src, uint64_t size);
+
+    // Only write the header.
+    // Return a pointer to the end of the header (where the points should start).
+    static auto write_header(uint8_t *dst, uint64_t time_, uint64_t frame_id_, uint64_t num_points_) {
+        const auto point_mem = dst + HEADER_SIZE;
         std::memset(dst, 0, HEADER_SIZE);  // Zero the header before writing
         dst = utils::append(dst, getInfo());
         dst = utils::append(dst, time_);
         dst = utils::append(dst, frame_id_);
         dst = utils::append(dst, num_points_);
+        return point_mem;
+    }
+
+    static auto write(uint8_t *dst, uint64_t time_, uint64_t frame_id_, uint64_t num_points_,
+                      const float *point_data_) {
+        const auto point_mem = write_header(dst, time_, frame_id_, num_points_);
         const auto point_cloud_bytes = pointCloudBytes(num_points_);
         memcpy(point_mem, point_data_, point_cloud_bytes);
         return point_mem + point_cloud_bytes;
@@ -105,5 +127,91 @@ struct PointCloud {
     }
 };
 
+/**
+ * A non-owning view of a serialized PointCloud.
+ * The header is parsed in place, and the points are exposed as a span into the message (directly after the header),
+ * so constructing a view never copies any points.
+ *
+ * As with StampedImageView, the span is only valid for as long as the underlying message is alive,
+ * unless the view was constructed from a std::shared_ptr to the message, in which case the view keeps it alive.
+ *
+ * If the message is invalid, then an error is printed and the view is empty.
+ */
+struct PointCloudView {
+    uint64_t time{};
+    uint64_t frame_id{};
+    uint64_t num_points{0};
+    Span<const Point> points;
+    // Keeps the underlying message alive (if the view was constructed with an owner)
+    std::shared_ptr<const void> owner;
+
+    PointCloudView() = default;
+
+    PointCloudView(const uint8_t *src, uint64_t size, std::shared_ptr<const void> owner_arg = nullptr)
+        : owner(std::move(owner_arg)) {
+        if (size < PointCloud::HEADER_SIZE) {
+            std::cerr << "This message is too small to be a PointCloud message." << std::endl;
+            return;
+        }
+        const auto point_mem = src + PointCloud::HEADER_SIZE;
+
+        // Check the info to make sure this message is the type we expect
+        MessageInfo info;
+        src = utils::read(src, info);
+        if (info != PointCloud::getInfo()) {
+            std::cerr << "This message either is not a PointCloud message, or is a different message version."
+                      << std::endl;
+            return;
+        }
+        uint64_t time_;
+        uint64_t frame_id_;
+        uint64_t num_points_;
+        src = utils::read(src, time_);
+        src = utils::read(src, frame_id_);
+        src = utils::read(src, num_points_);
+
+        // Make sure that the message actually contains all the points
+        if (num_points_ > (size - PointCloud::HEADER_SIZE) / sizeof(Point)) {
+            std::cerr << "The PointCloud message is truncated. It claims to have " << num_points_
+                      << " points, but only has " << size << " bytes." << std::endl;
+            return;
+        }
+
+        time = time_;
+        frame_id = frame_id_;
+        num_points = num_points_;
+        points = Span<const Point>(reinterpret_cast<const Point *>(point_mem), num_points_);
+    }
+
+    /**
+     * Construct a view that shares ownership of a message, e.g. a std::shared_ptr<::zmq::message_t>.
+     * Any type with data() and size() methods works.
+     */
+    template <typename Message>
+    explicit PointCloudView(const std::shared_ptr<Message> &msg)
+        : PointCloudView(static_cast<const uint8_t *>(msg->data()), msg->size(), msg) {}
+
+    [[nodiscard]] bool empty() const { return num_points == 0; }
+
+    [[nodiscard]] uint64_t pointCloudBytes() const { return PointCloud::pointCloudBytes(num_points); }
+
+    [[nodiscard]] uint64_t msgSize() const { return PointCloud::msgSize(num_points); }
+};
+
+inline PointCloud::PointCloud(const PointCloudView &view)
+    : time(view.time),
+      frame_id(view.frame_id),
+      num_points(view.num_points),
+      points(view.points.begin(), view.points.end()) {}
+
+inline bool PointCloud::read_into(const uint8_t *src, uint64_t size) {
+    const PointCloudView view(src, size);
+    time = view.time;
+    frame_id = view.frame_id;
+    num_points = view.num_points;
+    points.assign(view.points.begin(), view.points.end());
+    return not view.empty();
+}
+
 }  // namespace zmq
 }  // namespace nodar
\ No newline at end of file
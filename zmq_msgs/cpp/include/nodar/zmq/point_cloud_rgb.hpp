@@ -2,16 +2,20 @@
 
 #include <cassert>
 #include <iostream>
+#include <memory>
 #include <utility>
 #include <vector>
 
 #include "nodar/zmq/message_info.hpp"
 #include "nodar/zmq/point_cloud.hpp"
+#include "nodar/zmq/span.hpp"
 #include "nodar/zmq/utils.hpp"
 
 namespace nodar {
 namespace zmq {
 
+struct PointCloudRGBView;
+
 struct PointCloudRGB {
     static constexpr uint64_t HEADER_SIZE = 512;
     static constexpr MessageInfo getInfo() { return MessageInfo(5); }
@@ -41,6 +45,8 @@ struct PointCloudRGB {
 
     explicit PointCloudRGB(const uint8_t *src) { read(src); }
 
+    explicit PointCloudRGB(const PointCloudRGBView &view);
+
     [[nodiscard]] static constexpr uint64_t pointCloudBytes(uint64_t num_points_) {
         return num_points_ * sizeof(Point);
     }
@@ -60,10 +66,10 @@ struct PointCloudRGB {
         time = time_;
         frame_id = frame_id_;
         num_points = num_points_;
-        points.resize(num_points_);
-        memcpy(points.data(), point_data_, pointCloudBytes());
-        colors.resize(num_points_);
-        memcpy(colors.data(), color_data_, pointCloudBytes());
+        const auto points_begin = reinterpret_cast<const Point *>(point_data_);
+        points.assign(points_begin, points_begin + num_points_);
+        const auto colors_begin = reinterpret_cast<const Point *>(color_data_);
+        colors.assign(colors_begin, colors_begin + num_points_);
     }
 
     void read(const uint8_t *src) {
@@ -83,22 +89,37 @@ struct PointCloudRGB {
         src = utils::read(src, frame_id);
         src = utils::read(src, num_points);
 
-        // Read the point cloud
-        points.resize(num_points);
-        memcpy(points.data(), point_mem, pointCloudBytes());
-        colors.resize(num_points);
-        point_mem += pointCloudBytes();
-        memcpy(colors.data(), point_mem, pointCloudBytes());
+        // Read the point cloud.
+        // assign (rather than resize + memcpy) reuses the existing capacity and copies each point exactly once.
+        const auto points_begin = reinterpret_cast<const Point *>(point_mem);
+        points.assign(points_begin, points_begin + num_points);
+        const auto colors_begin = points_begin + num_points;
+        colors.assign(colors_begin, colors_begin + num_points);
     }
 
-    static auto write(uint8_t *dst, uint64_t time_, uint64_t frame_id_, uint64_t num_points_, const float *point_data_,
-                      const float *color_data_) {
-        auto point_mem = dst + HEADER_SIZE;
+    /**
+     * Read a message of the given size into this object, reusing the capacity of points and colors from previous reads.
+     * Unlike read, the message size is validated before anything is copied.
+     * If the message is invalid, then an error is printed and the point cloud is cleared.
+     * Returns false if the resulting point cloud is empty.
+     */
+    bool read_into(const uint8_t *src, uint64_t size);
+
+    // Only write the header.
+    // Return a pointer to the end of the header (where the points, followed by the colors, should start).
+    static auto write_header(uint8_t *dst, uint64_t time_, uint64_t frame_id_, uint64_t num_points_) {
+        const auto point_mem = dst + HEADER_SIZE;
         std::memset(dst, 0, HEADER_SIZE);  // Zero the header before writing
         dst = utils::append(dst, getInfo());
         dst = utils::append(dst, time_);
         dst = utils::append(dst, frame_id_);
         dst = utils::append(dst, num_points_);
+        return point_mem;
+    }
+
+    static auto write(uint8_t *dst, uint64_t time_, uint64_t frame_id_, uint64_t num_points_, const float *point_data_,
+                      const float *color_data_) {
+        auto point_mem = write_header(dst, time_, frame_id_, num_points_);
         const auto point_cloud_bytes = pointCloudBytes(num_points_);
         memcpy(point_mem, point_data_, point_cloud_bytes);
         point_mem += point_cloud_bytes;
@@ -112,5 +133,93 @@ struct PointCloudRGB {
     }
 };
 
+/**
+ * A non-owning view of a serialized PointCloudRGB.
+ * The points and colors are exposed as spans into the message, so constructing a view never copies any points.
+ * See PointCloudView for the lifetime rules.
+ *
+ * If the message is invalid, then an error is printed and the view is empty.
+ */
+struct PointCloudRGBView {
+    uint64_t time{};
+    uint64_t frame_id{};
+    uint64_t num_points{0};
+    Span<const Point> points;
+    Span<const Point> colors;
+    // Keeps the underlying message alive (if the view was constructed with an owner)
+    std::shared_ptr<const void> owner;
+
+    PointCloudRGBView() = default;
+
+    PointCloudRGBView(const uint8_t *src, uint64_t size, std::shared_ptr<const void> owner_arg = nullptr)
+        : owner(std::move(owner_arg)) {
+        if (size < PointCloudRGB::HEADER_SIZE) {
+            std::cerr << "This message is too small to be a PointCloudRGB message." << std::endl;
+            return;
+        }
+        const auto point_mem = src + PointCloudRGB::HEADER_SIZE;
+
+        // Check the info to make sure this message is the type we expect
+        MessageInfo info;
+        src = utils::read(src, info);
+        if (info != PointCloudRGB::getInfo()) {
+            std::cerr << "This message either is not a PointCloudRGB message, or is a different message version."
+                      << std::endl;
+            return;
+        }
+        uint64_t time_;
+        uint64_t frame_id_;
+        uint64_t num_points_;
+        src = utils::read(src, time_);
+        src = utils::read(src, frame_id_);
+        src = utils::read(src, num_points_);
+
+        // Make sure that the message actually contains all the points and colors
+        if (num_points_ > (size - PointCloudRGB::HEADER_SIZE) / (2 * sizeof(Point))) {
+            std::cerr << "The PointCloudRGB message is truncated. It claims to have " << num_points_
+                      << " points, but only has " << size << " bytes." << std::endl;
+            return;
+        }
+
+        time = time_;
+        frame_id = frame_id_;
+        num_points = num_points_;
+        const auto points_begin = reinterpret_cast<const Point *>(point_mem);
+        points = Span<const Point>(points_begin, num_points_);
+        colors = Span<const Point>(points_begin + num_points_, num_points_);
+    }
+
+    /**
+     * Construct a view that shares ownership of a message, e.g. a std::shared_ptr<::zmq::message_t>.
+     * Any type with data() and size() methods works.
+     */
+    template <typename Message>
+    explicit PointCloudRGBView(const std::shared_ptr<Message> &msg)
+        : PointCloudRGBView(static_cast<const uint8_t *>(msg->data()), msg->size(), msg) {}
+
+    [[nodiscard]] bool empty() const { return num_points == 0; }
+
+    [[nodiscard]] uint64_t pointCloudBytes() const { return PointCloudRGB::pointCloudBytes(num_points); }
+
+    [[nodiscard]] uint64_t msgSize() const { return PointCloudRGB::msgSize(num_points); }
+};
+
+inline PointCloudRGB::PointCloudRGB(const PointCloudRGBView &view)
+    : time(view.time),
+      frame_id(view.frame_id),
+      num_points(view.num_points),
+      points(view.points.begin(), view.points.end()),
+      colors(view.colors.begin(), view.colors.end()) {}
+
+inline bool PointCloudRGB::read_into(const uint8_t *src, uint64_t size) {
+    const PointCloudRGBView view(src, size);
+    time = view.time;
+    frame_id = view.frame_id;
+    num_points = view.num_points;
+    points.assign(view.points.begin(), view.points.end());
+    colors.assign(view.colors.begin(), view.colors.end());
+    return not view.empty();
+}
+
 }  // namespace zmq
 }  // namespace nodar
\ No newline at end of file
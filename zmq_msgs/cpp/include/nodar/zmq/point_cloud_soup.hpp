@@ -1,6 +1,9 @@
 #pragma once
 
+#include <array>
+#include <cassert>
 #include <iostream>
+#include <memory>
 #include <utility>
 
 #include "nodar/zmq/image.hpp"
@@ -25,6 +28,11 @@ struct PointCloudSoup {
     std::array<float, 9> rotation_world_to_raw_cam{};
     static constexpr uint64_t rotation_world_to_raw_cam_bytes = 9 * sizeof(rotation_world_to_raw_cam[0]);
 
+    // The size of everything before the stamped images
+    static constexpr uint64_t HEADER_SIZE = sizeof(MessageInfo) + sizeof(uint64_t) + sizeof(uint64_t) +
+                                            sizeof(double) + sizeof(double) + disparity_to_depth4x4_bytes +
+                                            rotation_disparity_to_raw_cam_bytes + rotation_world_to_raw_cam_bytes;
+
     StampedImage rectified;
     StampedImage disparity;
 
@@ -53,9 +61,7 @@ struct PointCloudSoup {
 
     [[nodiscard]] static constexpr uint64_t msgSize(uint32_t rows_, uint32_t cols_, uint32_t rectified_type_,
                                                     uint32_t disparity_type_) {
-        return sizeof(INFO) + sizeof(baseline) + sizeof(focal_length) + sizeof(time) + sizeof(frame_id) +
-               disparity_to_depth4x4_bytes + rotation_disparity_to_raw_cam_bytes + rotation_world_to_raw_cam_bytes +
-               StampedImage::msgSize(rows_, cols_, rectified_type_, 0) +
+        return HEADER_SIZE + StampedImage::msgSize(rows_, cols_, rectified_type_, 0) +
                StampedImage::msgSize(rows_, cols_, disparity_type_, 0);
     }
 
@@ -87,10 +93,10 @@ struct PointCloudSoup {
         memcpy(rotation_world_to_raw_cam.data(), src, rotation_world_to_raw_cam_bytes);
         src += rotation_world_to_raw_cam_bytes;
 
-        // Read the image data
-        rectified = StampedImage(src);
+        // Read the image data, reusing the memory of the previous images
+        rectified.read(src);
         src += rectified.msgSize();
-        disparity = StampedImage(src);
+        disparity.read(src);
         src += disparity.msgSize();
     }
 
@@ -188,5 +194,154 @@ struct PointCloudSoup {
     }
 };
 
+/**
+ * A non-owning view of a serialized PointCloudSoup, received either as one message or as multiple frames.
+ * Only the calibration header (times, baseline, focal length, and the matrices) is decoded up front.
+ * The rectified and disparity images are not decoded or copied until you ask for them,
+ * and even then they are returned as StampedImageViews that reference the message in place.
+ * So if you only need the disparity, or only need the Q-matrix, then you do not pay for the rest.
+ *
+ * Like StampedImageView, the view can share ownership of the message (e.g. a std::shared_ptr<::zmq::message_t>).
+ * Otherwise, the caller must ensure that the message outlives the view and the image views obtained from it.
+ *
+ * If the header is invalid, then an error is printed and the view is empty.
+ */
+struct PointCloudSoupView {
+    uint64_t time{};
+    uint64_t frame_id{};
+    double baseline{};
+    double focal_length{};
+    std::array<float, 16> disparity_to_depth4x4{};
+    std::array<float, 9> rotation_disparity_to_raw_cam{};
+    std::array<float, 9> rotation_world_to_raw_cam{};
+    // Keeps the underlying message alive (if the view was constructed with an owner)
+    std::shared_ptr<const void> owner;
+
+    PointCloudSoupView() = default;
+
+    PointCloudSoupView(const uint8_t *src, uint64_t size, std::shared_ptr<const void> owner_arg = nullptr)
+        : owner(std::move(owner_arg)) {
+        if (not readHeader(src, size)) {
+            return;
+        }
+        // Remember where the images are, but don't look at them yet
+        images = src + PointCloudSoup::HEADER_SIZE;
+        images_size = size - PointCloudSoup::HEADER_SIZE;
+    }
+
+    /**
+     * Construct a view over the frames of a multipart message (see multipart::writePointCloudSoupHeaders),
+     * that is, the soup header followed by the header of the rectified image, the rectified image data,
+     * the header of the disparity image, and the disparity image data.
+     */
+    PointCloudSoupView(Span<const uint8_t> soup_header,  //
+                       Span<const uint8_t> rectified_img,  //
+                       Span<const uint8_t> disparity_header,  //
+                       Span<const uint8_t> disparity_img,  //
+                       std::shared_ptr<const void> owner_arg = nullptr)
+        : owner(std::move(owner_arg)) {
+        if (not readHeader(soup_header.data(), soup_header.size())) {
+            return;
+        }
+        images = soup_header.data() + PointCloudSoup::HEADER_SIZE;
+        images_size = soup_header.size() - PointCloudSoup::HEADER_SIZE;
+        rectified_frame = rectified_img;
+        disparity_header_frame = disparity_header;
+        disparity_frame = disparity_img;
+        multipart = true;
+    }
+
+    /**
+     * Construct a view that shares ownership of a message, e.g. a std::shared_ptr<::zmq::message_t>.
+     * Any type with data() and size() methods works.
+     */
+    template <typename Message>
+    explicit PointCloudSoupView(const std::shared_ptr<Message> &msg)
+        : PointCloudSoupView(static_cast<const uint8_t *>(msg->data()), msg->size(), msg) {}
+
+    // True if the calibration header could not be decoded. The images are not checked.
+    [[nodiscard]] bool empty() const { return images == nullptr; }
+
+    // Decode the header of the rectified image. The pixels are not copied.
+    [[nodiscard]] StampedImageView rectified() const {
+        if (empty()) {
+            return {};
+        }
+        if (multipart) {
+            return {Span<const uint8_t>(images, images_size), rectified_frame, {}, owner};
+        }
+        return {images, images_size, owner};
+    }
+
+    // Decode the header of the disparity image. The pixels are not copied.
+    // This only needs to look at the header of the rectified image to find out where the disparity starts.
+    [[nodiscard]] StampedImageView disparity() const {
+        if (multipart) {
+            if (empty()) {
+                return {};
+            }
+            return {disparity_header_frame, disparity_frame, {}, owner};
+        }
+        const auto rectified_ = rectified();
+        if (rectified_.empty()) {
+            return {};
+        }
+        const auto offset = rectified_.msgSize();
+        return {images + offset, images_size - offset, owner};
+    }
+
+    // Copy everything into an owning PointCloudSoup
+    [[nodiscard]] PointCloudSoup copy() const {
+        return {time,
+                frame_id,
+                baseline,
+                focal_length,
+                disparity_to_depth4x4,
+                rotation_disparity_to_raw_cam,
+                rotation_world_to_raw_cam,
+                StampedImage(rectified()),
+                StampedImage(disparity())};
+    }
+
+private:
+    // The serialized images, or only the header of the rectified image if the soup was received in multiple frames
+    const uint8_t *images = nullptr;
+    uint64_t images_size = 0;
+    // The other frames of a multipart soup
+    bool multipart = false;
+    Span<const uint8_t> rectified_frame;
+    Span<const uint8_t> disparity_header_frame;
+    Span<const uint8_t> disparity_frame;
+
+    // Decode and validate the calibration header
+    bool readHeader(const uint8_t *src, uint64_t size) {
+        if (size < PointCloudSoup::HEADER_SIZE) {
+            std::cerr << "This message is too small to be a PointCloudSoup message." << std::endl;
+            return false;
+        }
+
+        // Check the info to make sure this message is the type we expect
+        MessageInfo info;
+        src = utils::read(src, info);
+        if (info != PointCloudSoup::getInfo()) {
+            std::cerr << "This message either is not a PointCloudSoup message, or is a different message version."
+                      << std::endl;
+            return false;
+        }
+
+        // Read the basic data types
+        src = utils::read(src, time);
+        src = utils::read(src, frame_id);
+        src = utils::read(src, baseline);
+        src = utils::read(src, focal_length);
+        memcpy(disparity_to_depth4x4.data(), src, PointCloudSoup::disparity_to_depth4x4_bytes);
+        src += PointCloudSoup::disparity_to_depth4x4_bytes;
+        memcpy(rotation_disparity_to_raw_cam.data(), src, PointCloudSoup::rotation_disparity_to_raw_cam_bytes);
+        src += PointCloudSoup::rotation_disparity_to_raw_cam_bytes;
+        memcpy(rotation_world_to_raw_cam.data(), src, PointCloudSoup::rotation_world_to_raw_cam_bytes);
+        return true;
+    }
+};
+
 }  // namespace zmq
 }  // namespace nodar
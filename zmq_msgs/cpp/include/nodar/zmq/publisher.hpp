@@ -1,60 +1,222 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <initializer_list>
+#include <iostream>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <nodar/zmq/topic_ports.hpp>
-#include <thread>
+#include <string>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 #include <zmq.hpp>
 
 #include "buffer_pool.hpp"
+#include "endpoint.hpp"
+#include "multipart.hpp"
+#include "multiplexer.hpp"
+#include "publisher_executor.hpp"
 
 namespace nodar {
 namespace zmq {
 
+/**
+ * What Publisher::send does when the send queue is full.
+ * Whatever is dropped is always released, so dropped buffers go straight back to their pool.
+ */
+enum class DropPolicy {
+    DROP_OLDEST,  // Drop the oldest queued message to make room. Subscribers always get the most recent data.
+    DROP_NEWEST,  // Drop the message that is being sent. The queued messages are sent in order.
+    BLOCK,  // Block the caller until there is room in the queue. Nothing is dropped.
+};
+
+struct PublisherStats {
+    uint64_t sent{0};  // Number of messages handed to ZMQ
+    uint64_t dropped{0};  // Number of messages dropped because the queue was full
+    size_t queue_high_water_mark{0};  // The largest number of messages that were ever queued at once
+};
+
 template <typename Data>
-class Publisher {
+class Publisher : private QueuedSender {
 private:
     Topic topic;
-    ::zmq::context_t context;
-    ::zmq::socket_t socket;
-    std::thread background_thread;
-    std::condition_variable condition;
+    // Only set if this publisher was not given an executor to share
+    std::unique_ptr<PublisherExecutor> own_executor;
+    PublisherExecutor* executor;
+    // Only set if this publisher was not given a multiplexer to share
+    std::unique_ptr<::zmq::socket_t> own_socket;
+    ::zmq::socket_t* socket;
+    // The frame that leads every message if this publisher shares a multiplexer, and empty otherwise
+    std::string routing_frame;
+    std::condition_variable space_available;
     std::mutex buffer_guard;
     std::atomic_bool running;
-    Buffer* queued_buffer = nullptr;
-    bool buffer_is_queued = false;
-    BufferPool buffer_pool;
+    // A ring of queued messages. Each message is a list of frames, and a single-part message is queued as one frame.
+    // The frame vectors are reused (and swapped with sending), so that queueing a message does not allocate
+    // in the steady state.
+    std::vector<std::vector<Frame>> queued;
+    // The frames of the message that the executor is sending. This is only touched from the executor thread.
+    std::vector<Frame> sending;
+    size_t queue_head = 0;
+    size_t queue_count = 0;
+    DropPolicy drop_policy;
+    std::atomic<uint64_t> sent_count{0};
+    std::atomic<uint64_t> dropped_count{0};
+    std::atomic<size_t> queue_high_water_mark{0};
+    // Every buffer that this publisher lends out holds a reference to the pool (see BufferPool::lend),
+    // since ZMQ may only release it after this publisher is gone, e.g. if the executor or multiplexer is shared
+    std::shared_ptr<BufferPool> buffer_pool;
 
 public:
-    Publisher(const Topic& topic, const std::string& ip)
-        : topic(topic), context(1), socket(context, ZMQ_PUB), running(true) {
-        socket.set(::zmq::sockopt::sndhwm, 1);  // set maximum queue length to 1 message
+    /**
+     * A pooled buffer that has been sized for exactly one message, and is waiting to be filled in and sent.
+     * Write the message into data(), or, if the loan came from Publisher::emplace, write the payload into payload().
+     * Then call send(). If the loan goes out of scope without being sent, then the buffer is returned to the pool.
+     * Loans are move-only, and must not outlive the publisher that they came from.
+     */
+    class Loan {
+        Publisher* publisher = nullptr;
+        Buffer* buffer = nullptr;
+        uint8_t* payload_ptr = nullptr;
+
+        friend class Publisher;
+        Loan(Publisher* publisher_arg, Buffer* buffer_arg)
+            : publisher(publisher_arg), buffer(buffer_arg), payload_ptr(buffer_arg->data()) {}
+
+    public:
+        Loan() = default;
+        Loan(const Loan&) = delete;
+        Loan& operator=(const Loan&) = delete;
+        Loan(Loan&& other) noexcept { *this = std::move(other); }
+        Loan& operator=(Loan&& other) noexcept {
+            if (this != &other) {
+                reset();
+                std::swap(publisher, other.publisher);
+                std::swap(buffer, other.buffer);
+                std::swap(payload_ptr, other.payload_ptr);
+            }
+            return *this;
+        }
+        ~Loan() { reset(); }
+
+        // The start of the message
+        [[nodiscard]] uint8_t* data() const { return buffer ? buffer->data() : nullptr; }
+
+        // The size of the message, as requested when the loan was made
+        [[nodiscard]] size_t size() const { return buffer ? buffer->size() : 0; }
+
+        // Where the payload should be written. For a Publisher::emplace loan, this is the end of the header.
+        [[nodiscard]] uint8_t* payload() const { return payload_ptr; }
+
+        // Queue the message to be sent. After this call, the loan is empty.
+        void send() {
+            if (buffer) {
+                publisher->send(buffer);
+                publisher = nullptr;
+                buffer = nullptr;
+                payload_ptr = nullptr;
+            }
+        }
+
+    private:
+        void reset() {
+            if (buffer) {
+                buffer->buffer_pool->put(buffer);
+            }
+            publisher = nullptr;
+            buffer = nullptr;
+            payload_ptr = nullptr;
+        }
+    };
+
+    /**
+     * Messages that are sent faster than the sender thread can hand them to ZMQ wait in a queue of queue_depth
+     * messages. When the queue is full, drop_policy decides what happens. The defaults keep only the latest message.
+     * This publisher gets its own ZMQ context and sender thread. To share them between publishers,
+     * use the constructor that takes a PublisherExecutor.
+     */
+    Publisher(const Topic& topic, const std::string& ip, size_t queue_depth = 1,
+              DropPolicy drop_policy = DropPolicy::DROP_OLDEST)
+        : Publisher(topic, ip, std::unique_ptr<PublisherExecutor>(new PublisherExecutor()), nullptr, nullptr,
+                    queue_depth, drop_policy) {}
+
+    /**
+     * Like the constructor above, but share the ZMQ context and the sender thread of an executor,
+     * which must outlive this publisher.
+     */
+    Publisher(const Topic& topic, const std::string& ip, PublisherExecutor& executor, size_t queue_depth = 1,
+              DropPolicy drop_policy = DropPolicy::DROP_OLDEST)
+        : Publisher(topic, ip, nullptr, &executor, nullptr, queue_depth, drop_policy) {}
+
+    /**
+     * Publish on the socket of a multiplexer (and on the sender thread of its executor),
+     * rather than binding the port of the topic. The multiplexer must outlive this publisher.
+     */
+    Publisher(const Topic& topic, Multiplexer& multiplexer, size_t queue_depth = 1,
+              DropPolicy drop_policy = DropPolicy::DROP_OLDEST)
+        : Publisher(topic, "", nullptr, &multiplexer.getExecutor(), &multiplexer, queue_depth, drop_policy) {}
+
+private:
+    Publisher(const Topic& topic, const std::string& ip, std::unique_ptr<PublisherExecutor> own_executor_arg,
+              PublisherExecutor* shared_executor, Multiplexer* multiplexer, size_t queue_depth,
+              DropPolicy drop_policy)
+        : topic(topic),
+          own_executor(std::move(own_executor_arg)),
+          executor(own_executor ? own_executor.get() : shared_executor),
+          own_socket(multiplexer ? nullptr : new ::zmq::socket_t(executor->getContext(), ZMQ_PUB)),
+          socket(multiplexer ? &multiplexer->getSocket() : own_socket.get()),
+          running(true),
+          queued(std::max<size_t>(queue_depth, 1)),
+          drop_policy(drop_policy),
+          buffer_pool(std::make_shared<BufferPool>()) {
+        if (multiplexer) {
+            routing_frame = routingFrame(topic);
+            std::cout << "Publishing " << topic.name << " on the multiplexed socket" << std::endl;
+            return;
+        }
+        socket->set(::zmq::sockopt::sndhwm, 1);  // set maximum queue length to 1 message
         // If the IP is empty, bind on this device.
+        // Besides tcp, also bind ipc and inproc, so that subscribers on this host or in this process can skip tcp
+        // (see connectEndpoint in endpoint.hpp).
         if (ip.empty()) {
-            const std::string endpoint = "tcp://*:" + std::to_string(topic.port);
-            std::cout << "Binding publisher for " << topic.name << " on the endpoint " << endpoint << std::endl;
-            socket.bind(endpoint);
+            for (const auto& endpoint : bindEndpoints(topic.port)) {
+                std::cout << "Binding publisher for " << topic.name << " on the endpoint " << endpoint << std::endl;
+                socket->bind(endpoint);
+            }
         } else {
             // Otherwise, assume this is a subscriber IP and connect to it
-            const std::string endpoint = "tcp://" + ip + ":" + std::to_string(topic.port);
+            const std::string endpoint = connectEndpoint(ip, topic.port, Transport::TCP);
             std::cout << "Connecting publisher for " << topic.name << " on the endpoint " << endpoint << std::endl;
-            socket.connect(endpoint);
+            socket->connect(endpoint);
         }
-        background_thread = std::thread(&Publisher::loop, this);
     }
 
-    ~Publisher() {
-        running = false;
-        condition.notify_all();
-        if (background_thread.joinable()) {
-            background_thread.join();
+public:
+    ~Publisher() override {
+        {
+            std::lock_guard<std::mutex> lock(buffer_guard);
+            running = false;
+        }
+        space_available.notify_all();
+        executor->cancel(this);
+        // Release anything that was queued but never sent
+        while (queue_count > 0) {
+            discardFront();
         }
     }
 
+    [[nodiscard]] PublisherStats stats() const {
+        PublisherStats stats;
+        stats.sent = sent_count;
+        stats.dropped = dropped_count;
+        stats.queue_high_water_mark = queue_high_water_mark;
+        return stats;
+    }
+
     /**
      * Get a buffer from the pool that this publisher owns.
      * Note that the buffer pool still owns the lifetime of the buffer.
@@ -66,8 +228,17 @@ public:
      * Note that if you end up not using the buffer or not calling the send method,
      * then you should return it to the pool using either the
      * BufferPool::put or Buffer::release method
+     *
+     * If you know how big the message will be, then pass its size as min_capacity,
+     * so that the buffer does not have to be reallocated when you resize it (see BufferPool::get).
      */
-    Buffer* getBuffer() { return buffer_pool.get(); }
+    Buffer* getBuffer(size_t min_capacity = 0) { return buffer_pool->lend(min_capacity); }
+
+    /**
+     * Pre-warm the buffer pool with count buffers of at least bytes bytes each (see BufferPool::reserve).
+     * Call this once at startup with the expected message size, and with a count of at least the queue depth plus one.
+     */
+    void reserveBuffers(size_t count, size_t bytes) { buffer_pool->reserve(count, bytes); }
 
     /**
      * Queue a buffer to be sent in the next loop iteration.
@@ -76,46 +247,149 @@ public:
      * Note that the BufferPool maintains ownership of the buffer throughout its lifetime,
      * so if a buffer never gets sent, we are sure that it will not leak.
      */
-    void send(Buffer* buffer) {
-        if (not running) {
+    void send(Buffer* buffer) { send({Frame(buffer)}); }
+
+    /**
+     * Serialize a message into a pooled buffer and queue it to be sent.
+     */
+    void publish(const Data& data) {
+        auto loan = this->loan(data.msgSize());
+        data.write(loan.data());
+        loan.send();
+    }
+
+    /**
+     * Borrow a pooled buffer of exactly msg_size bytes. The buffer is sized once, up front.
+     * Write the complete message into Loan::data(), and then call Loan::send().
+     */
+    Loan loan(uint64_t msg_size) {
+        auto buffer = buffer_pool->lend(msg_size);
+        buffer->resize(msg_size);
+        return Loan(this, buffer);
+    }
+
+    /**
+     * Borrow a pooled buffer of exactly msg_size bytes, and write the message header into it
+     * with Data::write_header(buffer, header_args...).
+     * The returned Loan::payload() points at the end of the header, so that you can render or capture the payload
+     * straight into the outgoing buffer, without an intermediate message struct or copy. For example,
+     *
+     *     auto loan = publisher.emplace(StampedImage::msgSize(rows, cols, type, 0),  //
+     *                                   time, frame_id, rows, cols, type, cvt_to_bgr_code, 0);
+     *     capture(loan.payload());
+     *     loan.send();
+     *
+     * It is up to you to make sure that msg_size matches the header.
+     */
+    template <typename... HeaderArgs>
+    Loan emplace(uint64_t msg_size, HeaderArgs&&... header_args) {
+        auto loan = this->loan(msg_size);
+        loan.payload_ptr = Data::write_header(loan.data(), std::forward<HeaderArgs>(header_args)...);
+        return loan;
+    }
+
+    /**
+     * Queue a multipart message to be sent in the next loop iteration.
+     * Each frame is sent without being copied, and is released once ZMQ is done with it (see Frame).
+     * Use this to send large payloads straight from the memory that they already live in,
+     * rather than serializing them into a Buffer first.
+     * Subscribers receive the frames with recvFrames (see multipart.hpp).
+     * If the queue is full, then the drop policy decides which message is dropped (and released), if any.
+     */
+    void send(std::initializer_list<Frame> frames) { queue(frames.begin(), frames.end()); }
+
+    void send(const std::vector<Frame>& frames) { queue(frames.begin(), frames.end()); }
+
+private:
+    template <typename Iterator>
+    void queue(Iterator begin, Iterator end) {
+        const auto discard = [begin, end] {
+            for (auto it = begin; it != end; ++it) {
+                it->discard();
+            }
+        };
+        if (begin == end) {
             return;
         }
-        // However, if a queued buffer never gets sent, then it will never be returned to the pool.
         {
-            std::lock_guard<std::mutex> lock(buffer_guard);
-            queued_buffer = buffer;
-            buffer_is_queued = true;
+            std::unique_lock<std::mutex> lock(buffer_guard);
+            if (queue_count == queued.size() and drop_policy == DropPolicy::BLOCK) {
+                space_available.wait(lock, [this] { return queue_count < queued.size() or not running; });
+            }
+            if (not running) {
+                lock.unlock();
+                discard();
+                return;
+            }
+            const auto full = queue_count == queued.size();
+            if (full) {
+                ++dropped_count;
+                if (drop_policy == DropPolicy::DROP_NEWEST) {
+                    lock.unlock();
+                    discard();
+                    return;
+                }
+                // The new message takes the place of the oldest one
+                discardFront();
+            }
+            queued[(queue_head + queue_count) % queued.size()].assign(begin, end);
+            ++queue_count;
+            if (queue_count > queue_high_water_mark) {
+                queue_high_water_mark = queue_count;
+            }
+            if (full) {
+                // The oldest message has already been scheduled, and its turn now sends the new one
+                return;
+            }
         }
-        condition.notify_one();
+        executor->schedule(this);
+    }
+
+    // Release the frames of the oldest queued message, and remove it from the queue. The caller must hold the lock.
+    void discardFront() {
+        auto& frames = queued[queue_head];
+        for (const auto& frame : frames) {
+            frame.discard();
+        }
+        frames.clear();
+        queue_head = (queue_head + 1) % queued.size();
+        --queue_count;
     }
 
-private:
     /**
-     * If the application has stopped running, then exit.
-     * Otherwise, take the queued buffer and send it.
+     * Take the oldest queued message and send it. This is called on the executor thread, once per queued message.
      * Note that we use the ZMQ free function to ensure that the
      * buffer will be released back to its pool after it is sent.
      * https://linux.die.net/man/3/zmq_msg_init_data
      * Furthermore, the BufferPool maintains ownership of the buffer throughout its lifetime.
      * So if a buffer never gets sent, we are sure that it will not leak.
      */
-    void loop() {
-        Buffer* buffer;
-        while (running) {
-            {
-                std::unique_lock<std::mutex> lock(buffer_guard);
-                condition.wait(lock, [this] { return buffer_is_queued or not running; });
-                if (not running) {
-                    break;
-                }
-                buffer = queued_buffer;
-                buffer_is_queued = false;
+    void sendNext() override {
+        {
+            std::lock_guard<std::mutex> lock(buffer_guard);
+            if (queue_count == 0 or not running) {
+                return;
             }
+            // Swapping with the queue (rather than copying it) means that neither vector reallocates
+            sending.swap(queued[queue_head]);
+            queue_head = (queue_head + 1) % queued.size();
+            --queue_count;
+        }
+        space_available.notify_one();
 
-            // Create a message around the buffer and send it.
-            ::zmq::message_t msg(buffer->data(), buffer->size(), Buffer::release, buffer);
-            socket.send(msg, ::zmq::send_flags::none);
+        // Create a message around each frame and send it. ZMQ delivers all the frames or none of them.
+        if (not routing_frame.empty()) {
+            ::zmq::message_t route(routing_frame.data(), routing_frame.size());
+            socket->send(route, ::zmq::send_flags::sndmore);
+        }
+        for (size_t i = 0; i < sending.size(); ++i) {
+            const auto& frame = sending[i];
+            ::zmq::message_t msg(const_cast<void*>(frame.data), frame.size, frame.release, frame.hint);
+            const auto flags = i + 1 < sending.size() ? ::zmq::send_flags::sndmore : ::zmq::send_flags::none;
+            socket->send(msg, flags);
         }
+        ++sent_count;
+        sending.clear();
     }
 };
 
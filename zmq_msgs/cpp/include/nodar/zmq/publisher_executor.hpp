@@ -0,0 +1,107 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <zmq.hpp>
+
+namespace nodar {
+namespace zmq {
+
+/**
+ * Anything that queues messages and hands them to ZMQ on a PublisherExecutor thread, i.e. a Publisher.
+ */
+class QueuedSender {
+public:
+    virtual ~QueuedSender() = default;
+
+    // Send the oldest queued message, if there is one. This is only ever called from the executor thread.
+    virtual void sendNext() = 0;
+};
+
+/**
+ * A ZMQ context and a single sender thread that can be shared by many publishers.
+ *
+ * By default, every Publisher creates its own executor, that is, its own ZMQ context (with its own I/O thread),
+ * and its own sender thread. A process that publishes many topics can instead create one executor,
+ * and pass it to all of its publishers, so that they share one context, io_threads ZMQ I/O threads,
+ * and one sender thread. The ZMQ guide suggests one I/O thread per gigabyte per second of data,
+ * so the default of 1 is plenty for most hosts.
+ *
+ * Messages are sent in the order in which they were queued, across all the publishers.
+ * The executor must outlive all the publishers that use it.
+ */
+class PublisherExecutor {
+public:
+    explicit PublisherExecutor(int io_threads = 1) : context(io_threads), running(true) {
+        sender_thread = std::thread(&PublisherExecutor::loop, this);
+    }
+
+    PublisherExecutor(const PublisherExecutor&) = delete;
+    PublisherExecutor& operator=(const PublisherExecutor&) = delete;
+
+    ~PublisherExecutor() {
+        {
+            std::lock_guard<std::mutex> lock(guard);
+            running = false;
+        }
+        condition.notify_all();
+        if (sender_thread.joinable()) {
+            sender_thread.join();
+        }
+    }
+
+    ::zmq::context_t& getContext() { return context; }
+
+    // Ask the sender thread to call sender->sendNext(). Call this once for every message that is queued.
+    void schedule(QueuedSender* sender) {
+        {
+            std::lock_guard<std::mutex> lock(guard);
+            ready.push_back(sender);
+        }
+        condition.notify_one();
+    }
+
+    // Forget everything that was scheduled for sender, and wait until the sender thread is no longer using it.
+    void cancel(QueuedSender* sender) {
+        std::unique_lock<std::mutex> lock(guard);
+        ready.erase(std::remove(ready.begin(), ready.end(), sender), ready.end());
+        idle.wait(lock, [this, sender] { return busy != sender; });
+    }
+
+private:
+    ::zmq::context_t context;
+    std::thread sender_thread;
+    std::mutex guard;
+    std::condition_variable condition;
+    std::condition_variable idle;
+    std::atomic_bool running;
+    std::deque<QueuedSender*> ready;
+    QueuedSender* busy = nullptr;
+
+    void loop() {
+        while (running) {
+            {
+                std::unique_lock<std::mutex> lock(guard);
+                condition.wait(lock, [this] { return not ready.empty() or not running; });
+                if (not running) {
+                    break;
+                }
+                busy = ready.front();
+                ready.pop_front();
+            }
+            busy->sendNext();
+            {
+                std::lock_guard<std::mutex> lock(guard);
+                busy = nullptr;
+            }
+            idle.notify_all();
+        }
+    }
+};
+
+}  // namespace zmq
+}  // namespace nodar
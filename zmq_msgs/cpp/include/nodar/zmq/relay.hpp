@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <nodar/zmq/topic_ports.hpp>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <zmq.hpp>
+
+#include "endpoint.hpp"
+#include "multipart.hpp"
+#include "publisher_executor.hpp"
+
+namespace nodar {
+namespace zmq {
+
+struct RelayStats {
+    uint64_t received{0};  // Number of messages that were received from the device and re-published
+    bool subscribed{false};  // Whether anybody is subscribed to the relayed topic at the moment
+    uint64_t replayed{0};  // Number of times that the last message was re-sent to a new subscriber (LastValueCache)
+};
+
+/**
+ * Subscribes to topics on a device once, and re-publishes them to any number of subscribers on this host
+ * (or on this side of a slow link), so that the device only sends every frame once, however many viewers,
+ * recorders and monitors are running.
+ *
+ * Each topic is received by an XSUB socket that is connected to the device, and re-published by an XPUB socket
+ * that binds the same endpoints as a Publisher would (see bindEndpoints), on the port of the topic plus port_offset.
+ * So subscribers reach the relay exactly like they reach the device, e.g. Subscriber(topic, relay_ip),
+ * and subscribers on the same host as the relay automatically use ipc (see connectEndpoint).
+ * With local_only, the relay does not bind tcp (unless ipc is disabled, in which case it binds tcp on localhost).
+ *
+ * The subscriptions of the downstream subscribers are forwarded to the device, so a topic is only pulled from the
+ * device while somebody is subscribed to it. Messages are forwarded frame by frame, without being copied or decoded.
+ *
+ * Every downstream subscriber gets its own queue of queue_depth messages. The relay never waits for a subscriber:
+ * once the queue of a stalled subscriber is full, ZMQ drops the messages for that subscriber only,
+ * so one stalled viewer cannot add latency for a recorder that keeps up.
+ */
+class Relay {
+public:
+    Relay(const std::vector<Topic> &topics, const std::string &ip, int queue_depth = 1, uint16_t port_offset = 0,
+          bool local_only = false)
+        : Relay(topics, ip, std::unique_ptr<PublisherExecutor>(new PublisherExecutor()), nullptr, queue_depth,
+                port_offset, local_only, false) {}
+
+    /**
+     * Like the constructor above, but use the ZMQ context of an executor, which must outlive this relay.
+     * Subscribers in this process can then also use the inproc endpoints of the relay.
+     */
+    Relay(const std::vector<Topic> &topics, const std::string &ip, PublisherExecutor &executor, int queue_depth = 1,
+          uint16_t port_offset = 0, bool local_only = false)
+        : Relay(topics, ip, nullptr, &executor, queue_depth, port_offset, local_only, false) {}
+
+    Relay(const Relay &) = delete;
+    Relay &operator=(const Relay &) = delete;
+
+    ~Relay() {
+        running = false;
+        if (relay_thread.joinable()) {
+            relay_thread.join();
+        }
+    }
+
+    // The stats of every topic, in the order in which the topics were given
+    [[nodiscard]] std::vector<RelayStats> stats() const {
+        std::vector<RelayStats> all;
+        for (const auto &relayed : relayed_topics) {
+            RelayStats stats;
+            stats.received = relayed->received;
+            stats.subscribed = relayed->subscriptions > 0;
+            stats.replayed = relayed->replayed;
+            all.push_back(stats);
+        }
+        return all;
+    }
+
+protected:
+    // If cache_last_value, then every new subscriber immediately gets the last message (see LastValueCache)
+    Relay(const std::vector<Topic> &topics, const std::string &ip, std::unique_ptr<PublisherExecutor> own_executor_arg,
+          PublisherExecutor *shared_executor, int queue_depth, uint16_t port_offset, bool local_only,
+          bool cache_last_value_arg)
+        : own_executor(std::move(own_executor_arg)),
+          executor(own_executor ? own_executor.get() : shared_executor),
+          cache_last_value(cache_last_value_arg) {
+        for (const auto &topic : topics) {
+            std::unique_ptr<RelayedTopic> relayed(new RelayedTopic(topic, executor->getContext()));
+            relayed->upstream.set(::zmq::sockopt::rcvhwm, queue_depth);
+            const auto upstream_endpoint = connectEndpoint(ip, topic);
+            std::cout << "Relaying " << topic.name << " from the endpoint " << upstream_endpoint << std::endl;
+            relayed->upstream.connect(upstream_endpoint);
+            if (cache_last_value) {
+                // Keep receiving every message, so that there is a last message for whoever subscribes next
+                ::zmq::message_t subscribe_all(1);
+                *static_cast<uint8_t *>(subscribe_all.data()) = 1;
+                relayed->upstream.send(subscribe_all, ::zmq::send_flags::none);
+            }
+
+            // The high water mark of an XPUB socket applies to each subscriber separately
+            relayed->downstream.set(::zmq::sockopt::sndhwm, queue_depth);
+            // Do not wait for stalled subscribers when the relay is destroyed
+            relayed->downstream.set(::zmq::sockopt::linger, 0);
+            if (cache_last_value) {
+                // Report every subscription, rather than only the first one of each prefix,
+                // so that every new subscriber can be sent the last message
+#ifdef ZMQ_XPUB_VERBOSER
+                relayed->downstream.set(::zmq::sockopt::xpub_verboser, 1);
+                every_unsubscription = true;
+#else
+                relayed->downstream.set(::zmq::sockopt::xpub_verbose, 1);
+#endif
+            }
+            const auto port = static_cast<uint16_t>(topic.port + port_offset);
+            for (const auto &endpoint : downstreamEndpoints(port, local_only)) {
+                std::cout << "Re-publishing " << topic.name << " on the endpoint " << endpoint << std::endl;
+                relayed->downstream.bind(endpoint);
+            }
+            relayed_topics.push_back(std::move(relayed));
+        }
+        for (const auto &relayed : relayed_topics) {
+            items.push_back({relayed->upstream.handle(), 0, ZMQ_POLLIN, 0});
+            items.push_back({relayed->downstream.handle(), 0, ZMQ_POLLIN, 0});
+        }
+        relay_thread = std::thread(&Relay::loop, this);
+    }
+
+private:
+    // One topic, with its upstream and downstream sockets
+    struct RelayedTopic {
+        Topic topic;
+        ::zmq::socket_t upstream;
+        ::zmq::socket_t downstream;
+        std::atomic<uint64_t> received{0};
+        std::atomic<uint64_t> replayed{0};
+        // The number of downstream subscriptions of each prefix. Unless every_unsubscription, a prefix is removed by
+        // its first reported unsubscription. Only the first subscription and the last unsubscription of a prefix
+        // are forwarded to the device.
+        std::map<std::string, int> prefixes;
+        std::atomic<size_t> subscriptions{0};
+        // The frames of the last message (only kept by a LastValueCache)
+        std::vector<::zmq::message_t> last_value;
+
+        RelayedTopic(const Topic &topic_arg, ::zmq::context_t &context)
+            : topic(topic_arg), upstream(context, ZMQ_XSUB), downstream(context, ZMQ_XPUB) {}
+    };
+
+    // Only set if this relay was not given an executor to share
+    std::unique_ptr<PublisherExecutor> own_executor;
+    PublisherExecutor *executor;
+    std::vector<std::unique_ptr<RelayedTopic>> relayed_topics;
+    std::vector<::zmq::pollitem_t> items;
+    const bool cache_last_value;
+    // Whether XPUB reports every unsubscription (xpub_verboser). Otherwise, it only reports the last one of each
+    // prefix, so the subscriptions of a prefix cannot be counted, and a prefix is either subscribed or not.
+    bool every_unsubscription = false;
+    std::atomic_bool running{true};
+    std::thread relay_thread;
+
+    static std::vector<std::string> downstreamEndpoints(uint16_t port, bool local_only) {
+        auto endpoints = bindEndpoints(port);
+        if (local_only) {
+            endpoints.erase(std::remove_if(endpoints.begin(), endpoints.end(),
+                                           [](const std::string &endpoint) { return endpoint.find("tcp://") == 0; }),
+                            endpoints.end());
+            if (not ipcEnabled()) {
+                endpoints.push_back("tcp://127.0.0.1:" + std::to_string(port));
+            }
+        }
+        return endpoints;
+    }
+
+    void loop() {
+        std::vector<::zmq::message_t> frames;
+        while (running) {
+            if (items.empty()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            try {
+                // Wake up regularly, so that the thread notices when it should stop
+                if (::zmq::poll(items.data(), items.size(), 100) <= 0) {
+                    continue;
+                }
+            } catch (const ::zmq::error_t &error) {
+                if (error.num() != EINTR) {
+                    std::cerr << "Polling the relayed topics failed: " << error.what() << std::endl;
+                }
+                continue;
+            }
+            for (size_t i = 0; i < relayed_topics.size(); ++i) {
+                auto &relayed = *relayed_topics[i];
+                if (items[2 * i + 1].revents & ZMQ_POLLIN) {
+                    forwardSubscriptions(relayed, frames);
+                }
+                if (items[2 * i].revents & ZMQ_POLLIN) {
+                    forwardMessages(relayed, frames);
+                }
+            }
+        }
+    }
+
+    // Pass the (un)subscriptions of the downstream subscribers on to the device
+    void forwardSubscriptions(RelayedTopic &relayed, std::vector<::zmq::message_t> &frames) {
+        while (recvFrames(relayed.downstream, frames, ::zmq::recv_flags::dontwait)) {
+            for (auto &frame : frames) {
+                // A subscription message is a 1 (subscribe) or a 0 (unsubscribe), followed by the prefix
+                if (frame.size() == 0) {
+                    continue;
+                }
+                const auto data = static_cast<const char *>(frame.data());
+                const auto subscribe = data[0] == 1;
+                const std::string prefix(data + 1, frame.size() - 1);
+                auto &count = relayed.prefixes[prefix];
+                if (subscribe) {
+                    ++count;
+                } else {
+                    count = every_unsubscription ? count - 1 : 0;
+                }
+                const auto changed = subscribe ? count == 1 : count <= 0;
+                if (count <= 0) {
+                    relayed.prefixes.erase(prefix);
+                }
+                relayed.subscriptions = relayed.prefixes.size();
+                // A LastValueCache is already subscribed to everything
+                if (changed and not cache_last_value) {
+                    relayed.upstream.send(frame, ::zmq::send_flags::dontwait);
+                }
+                if (subscribe and cache_last_value) {
+                    replay(relayed);
+                }
+            }
+        }
+    }
+
+    /**
+     * Send the last message again, so that a new subscriber does not have to wait for the next one.
+     * XPUB cannot send to a single subscriber, so the subscribers that already got it get it again.
+     */
+    void replay(RelayedTopic &relayed) {
+        if (relayed.last_value.empty()) {
+            return;
+        }
+        for (size_t i = 0; i < relayed.last_value.size(); ++i) {
+            // This shares the data of the frame, rather than copying it (unless the frame is tiny)
+            ::zmq::message_t frame;
+            frame.copy(relayed.last_value[i]);
+            const auto flags = i + 1 < relayed.last_value.size() ? ::zmq::send_flags::sndmore : ::zmq::send_flags::none;
+            relayed.downstream.send(frame, flags);
+        }
+        ++relayed.replayed;
+    }
+
+    // Re-publish every message that has arrived from the device. An XPUB socket never blocks on a slow subscriber.
+    void forwardMessages(RelayedTopic &relayed, std::vector<::zmq::message_t> &frames) {
+        while (recvFrames(relayed.upstream, frames, ::zmq::recv_flags::dontwait)) {
+            if (cache_last_value) {
+                relayed.last_value.resize(frames.size());
+                for (size_t i = 0; i < frames.size(); ++i) {
+                    relayed.last_value[i].copy(frames[i]);
+                }
+            }
+            for (size_t i = 0; i < frames.size(); ++i) {
+                const auto flags = i + 1 < frames.size() ? ::zmq::send_flags::sndmore : ::zmq::send_flags::none;
+                relayed.downstream.send(frames[i], flags);
+            }
+            ++relayed.received;
+        }
+    }
+};
+
+}  // namespace zmq
+}  // namespace nodar
@@ -0,0 +1,662 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <zmq.hpp>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "endpoint.hpp"
+#include "message_info.hpp"
+#include "publisher.hpp"
+#include "span.hpp"
+#include "utils.hpp"
+
+namespace nodar {
+namespace zmq {
+
+/**
+ * Same-host shared-memory transport for large messages, e.g. the IMAGE_TOPICS and the SOUP_TOPIC.
+ *
+ * A SharedMemoryPublisher writes each message into a slot of a ring that lives in a POSIX shared memory segment,
+ * and only sends a small SharedMemoryDescriptor (which slot, which generation of that slot, and how many bytes)
+ * over the ipc endpoint sharedMemoryEndpoint(port). A SharedMemorySubscriber on the same host maps the segment,
+ * and reads the messages in place, so a frame is never copied through a socket.
+ *
+ * The same publisher also sends the regular wire format on the usual endpoints of the port (see bindEndpoints),
+ * straight out of the slot, so remote subscribers, and local subscribers that do not use shared memory,
+ * receive exactly what a Publisher would have sent them.
+ *
+ * Readers do not lock slots. Instead, every slot carries a generation, which is odd while the producer writes
+ * into the slot, and is bumped every time the slot is reused. A subscriber only hands out a message if its slot
+ * still has the generation of the descriptor, and SharedMemoryMessage::valid tells you whether the producer has
+ * since started to overwrite it. So check valid() once you are done reading a message,
+ * and discard whatever you computed from it if it returns false. With N slots, a subscriber has roughly
+ * N - 1 frame periods to read each message.
+ *
+ * This is only available on POSIX systems, and only when ipc is enabled (see ipcEnabled).
+ * Otherwise, the publisher falls back to sending the wire format only.
+ */
+
+/**
+ * Where a message lives in the shared memory ring of a port.
+ * This is the message that SharedMemoryPublisher sends over sharedMemoryEndpoint(port).
+ */
+struct SharedMemoryDescriptor {
+    static constexpr uint64_t MSG_SIZE = 32;
+    static constexpr MessageInfo getInfo() { return MessageInfo(10); }
+
+    uint64_t segment_id{};  // Changes whenever the producer recreates the segment
+    uint32_t slot{};
+    uint64_t generation{};
+    uint64_t size{};
+
+    auto write(uint8_t *dst) const {
+        dst = utils::append(dst, getInfo());
+        dst = utils::append(dst, slot);
+        dst = utils::append(dst, segment_id);
+        dst = utils::append(dst, generation);
+        dst = utils::append(dst, size);
+        return dst;
+    }
+
+    bool read(const uint8_t *src, size_t src_size) {
+        if (src_size < MSG_SIZE) {
+            std::cerr << "This message is too small to be a shared memory descriptor." << std::endl;
+            return false;
+        }
+        MessageInfo info;
+        src = utils::read(src, info);
+        if (info.is_different(getInfo(), "SharedMemoryDescriptor")) {
+            return false;
+        }
+        src = utils::read(src, slot);
+        src = utils::read(src, segment_id);
+        src = utils::read(src, generation);
+        src = utils::read(src, size);
+        return true;
+    }
+};
+
+// The name of the POSIX shared memory segment of a port
+inline std::string sharedMemoryName(uint16_t port) { return "/nodar_zmq_" + std::to_string(port); }
+
+// The ipc endpoint over which the descriptors of a port are published
+inline std::string sharedMemoryEndpoint(uint16_t port) {
+    return "ipc://" + ipcDirectory() + "/nodar_zmq_" + std::to_string(port) + ".shm.ipc";
+}
+
+/**
+ * Whether a publisher on the device with the given IP address is serving a port over shared memory.
+ * This is only ever the case if that device is this host.
+ */
+inline bool sharedMemoryAvailable(const std::string &ip, uint16_t port) {
+    return isLocalHost(ip) and ipcEnabled() and ipcSocketExists(sharedMemoryEndpoint(port).substr(6));
+}
+
+/**
+ * A mapping of a shared memory segment that holds a ring of slot_count slots of slot_size bytes each.
+ * The segment starts with a Header, followed by one SlotState per slot, followed by the slots themselves.
+ * Use create in the producer, and open in the consumers.
+ */
+class SharedMemorySegment {
+public:
+    static constexpr uint64_t MAGIC = 0x6d68737261646f6e;  // "nodarshm"
+    static constexpr size_t PAGE_SIZE = 4096;
+
+    struct Header {
+        std::atomic<uint64_t> magic;  // Written last, so that consumers never see a half-initialized header
+        uint64_t segment_id;
+        uint64_t slot_count;
+        uint64_t slot_size;
+    };
+
+    struct alignas(64) SlotState {
+        std::atomic<uint64_t> generation;
+    };
+
+#if ATOMIC_LLONG_LOCK_FREE != 2
+#error "The shared memory transport needs lock-free 64-bit atomics, since they are shared between processes"
+#endif
+
+    SharedMemorySegment(const SharedMemorySegment &) = delete;
+    SharedMemorySegment &operator=(const SharedMemorySegment &) = delete;
+
+    ~SharedMemorySegment() {
+#ifndef _WIN32
+        munmap(base, mapped_size);
+        if (owner) {
+            shm_unlink(name.c_str());
+        }
+#endif
+    }
+
+    /**
+     * Create (or replace) the segment with the given name, with slot_count slots of at least slot_size bytes each.
+     * The memory is allocated up front, so that a full /dev/shm is reported here, rather than with a SIGBUS later.
+     * Returns nullptr, after printing the reason, if the segment could not be created.
+     */
+    static std::unique_ptr<SharedMemorySegment> create(const std::string &name, uint32_t slot_count, size_t slot_size) {
+#ifdef _WIN32
+        return nullptr;
+#else
+        slot_size = roundUp(slot_size, PAGE_SIZE);
+        const auto size = slotsOffset(slot_count) + slot_count * slot_size;
+        // Remove whatever a previous producer left behind. Consumers that still map it keep their mapping.
+        shm_unlink(name.c_str());
+        const auto fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) {
+            std::cerr << "Could not create the shared memory segment " << name << ": " << std::strerror(errno)
+                      << std::endl;
+            return nullptr;
+        }
+#ifdef __APPLE__
+        // macOS has no posix_fallocate, so a full /dev/shm is not caught here
+        const auto error = ftruncate(fd, static_cast<off_t>(size)) == 0 ? 0 : errno;
+#else
+        const auto error = posix_fallocate(fd, 0, static_cast<off_t>(size));
+#endif
+        if (error != 0) {
+            std::cerr << "Could not allocate " << size << " bytes for the shared memory segment " << name << ": "
+                      << std::strerror(error) << std::endl;
+            close(fd);
+            shm_unlink(name.c_str());
+            return nullptr;
+        }
+        const auto base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            std::cerr << "Could not map the shared memory segment " << name << ": " << std::strerror(errno)
+                      << std::endl;
+            shm_unlink(name.c_str());
+            return nullptr;
+        }
+        std::unique_ptr<SharedMemorySegment> segment(new SharedMemorySegment(name, base, size, true));
+        auto header = new (base) Header;
+        header->segment_id = static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count()) ^
+                             (static_cast<uint64_t>(getpid()) << 48);
+        header->slot_count = slot_count;
+        header->slot_size = slot_size;
+        for (uint32_t slot = 0; slot < slot_count; ++slot) {
+            new (segment->state(slot)) SlotState{{0}};
+        }
+        header->magic.store(MAGIC, std::memory_order_release);
+        return segment;
+#endif
+    }
+
+    /**
+     * Map an existing segment read-only.
+     * Returns nullptr, after printing the reason, if it does not exist or is not (yet) a valid segment.
+     */
+    static std::unique_ptr<SharedMemorySegment> open(const std::string &name) {
+#ifdef _WIN32
+        return nullptr;
+#else
+        const auto fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            std::cerr << "Could not open the shared memory segment " << name << ": " << std::strerror(errno)
+                      << std::endl;
+            return nullptr;
+        }
+        struct stat info {};
+        if (fstat(fd, &info) != 0 or static_cast<size_t>(info.st_size) < sizeof(Header)) {
+            close(fd);
+            std::cerr << "The shared memory segment " << name << " is not initialized yet." << std::endl;
+            return nullptr;
+        }
+        const auto size = static_cast<size_t>(info.st_size);
+        const auto base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            std::cerr << "Could not map the shared memory segment " << name << ": " << std::strerror(errno)
+                      << std::endl;
+            return nullptr;
+        }
+        std::unique_ptr<SharedMemorySegment> segment(new SharedMemorySegment(name, base, size, false));
+        const auto header = segment->header();
+        if (header->magic.load(std::memory_order_acquire) != MAGIC or
+            slotsOffset(header->slot_count) + header->slot_count * header->slot_size > size) {
+            std::cerr << "The shared memory segment " << name << " is not initialized yet." << std::endl;
+            return nullptr;
+        }
+        return segment;
+#endif
+    }
+
+    // Do not unlink the segment when this mapping is destroyed, e.g. because a newer segment has taken over its name
+    void disown() { owner = false; }
+
+    [[nodiscard]] uint64_t segmentId() const { return header()->segment_id; }
+
+    [[nodiscard]] uint32_t slotCount() const { return static_cast<uint32_t>(header()->slot_count); }
+
+    [[nodiscard]] size_t slotSize() const { return header()->slot_size; }
+
+    [[nodiscard]] SlotState *state(uint32_t slot) const {
+        return reinterpret_cast<SlotState *>(static_cast<uint8_t *>(base) + sizeof(SlotState)) + slot;
+    }
+
+    [[nodiscard]] uint8_t *slot(uint32_t slot) const {
+        return static_cast<uint8_t *>(base) + slotsOffset(slotCount()) + slot * slotSize();
+    }
+
+private:
+    std::string name;
+    void *base;
+    size_t mapped_size;
+    bool owner;
+
+    SharedMemorySegment(std::string name_arg, void *base_arg, size_t size, bool owner_arg)
+        : name(std::move(name_arg)), base(base_arg), mapped_size(size), owner(owner_arg) {}
+
+    [[nodiscard]] Header *header() const { return static_cast<Header *>(base); }
+
+    static size_t roundUp(size_t size, size_t multiple) { return (size + multiple - 1) / multiple * multiple; }
+
+    // The header takes the first SlotState-sized block, and the slot states follow it
+    static size_t slotsOffset(size_t slot_count) { return roundUp((slot_count + 1) * sizeof(SlotState), PAGE_SIZE); }
+
+    static_assert(sizeof(Header) <= sizeof(SlotState), "The header must fit in front of the slot states");
+};
+
+/**
+ * A message that a SharedMemorySubscriber read in place from a shared memory ring.
+ * The data stays mapped for as long as this message (or a copy of the owner) is alive,
+ * but the producer may overwrite it once it has gone around the ring. See valid().
+ */
+struct SharedMemoryMessage {
+    Span<const uint8_t> data;
+    // Keeps the segment mapped. Pass it as the owner of any view of the data.
+    std::shared_ptr<const void> owner;
+    const std::atomic<uint64_t> *generation = nullptr;
+    uint64_t expected_generation = 0;
+
+    [[nodiscard]] bool empty() const { return data.empty(); }
+
+    /**
+     * Whether the data is still the message that was published. Call this once you are done reading the data.
+     * If it returns false, then the producer has started to reuse the slot, and what you read may be torn.
+     */
+    [[nodiscard]] bool valid() const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return generation and generation->load(std::memory_order_relaxed) == expected_generation;
+    }
+};
+
+/**
+ * Publish messages over a same-host shared memory ring, as well as in the regular wire format.
+ * Use it like a Publisher: loan (or emplace) a slot, write the message into it, and send it.
+ * The wire format frames point straight into the slot, and a slot is not reused until ZMQ has released them.
+ * If every slot is still in use, or a message is larger than a slot and the segment could not be grown,
+ * then the message is written into a pooled buffer, and only sent in the wire format (see fallbacks()).
+ * This always binds on this device, since shared memory is of no use to a publisher that connects to a subscriber.
+ */
+template <typename Data>
+class SharedMemoryPublisher {
+    // A segment along with how many references ZMQ still holds to each of its slots.
+    // When the segment has to grow, the old ring is retired until ZMQ has released all of its slots.
+    struct Ring {
+        std::unique_ptr<SharedMemorySegment> segment;
+        std::unique_ptr<std::atomic<uint32_t>[]> pins;
+        uint32_t next_slot = 0;
+
+        [[nodiscard]] bool pinned() const {
+            for (uint32_t slot = 0; slot < segment->slotCount(); ++slot) {
+                if (pins[slot].load(std::memory_order_acquire) != 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+    struct Rings {
+        std::unique_ptr<Ring> current;
+        std::vector<std::unique_ptr<Ring>> retired;
+
+        // ZMQ may still be sending frames that point into the rings, from a context that outlives the publisher.
+        // Give it a moment to release them, and rather leak a ring than unmap it under ZMQ's feet.
+        ~Rings() {
+            if (current) {
+                retired.push_back(std::move(current));
+            }
+            for (auto &old : retired) {
+                for (int attempt = 0; old->pinned() and attempt < 1000; ++attempt) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                if (old->pinned()) {
+                    std::cerr << "ZMQ did not release a shared memory ring in time. Leaking it." << std::endl;
+                    old.release();
+                }
+            }
+        }
+    };
+    // The rings are declared first, so that they outlive the publisher (and its queue of frames that point into them)
+    Rings rings;
+    // Only set if this publisher was not given an executor to share
+    std::unique_ptr<PublisherExecutor> own_executor;
+    Publisher<Data> publisher;
+    uint16_t port;
+    uint32_t slot_count;
+    // Descriptors are tiny, so they are sent from the calling thread rather than queued on the executor
+    ::zmq::socket_t descriptor_socket;
+    bool descriptors_bound = false;
+    std::mutex guard;
+    std::atomic<uint64_t> fallback_count{0};
+
+    static void unpin(void *, void *hint) {
+        static_cast<std::atomic<uint32_t> *>(hint)->fetch_sub(1, std::memory_order_release);
+    }
+
+public:
+    /**
+     * A slot (or, in the fallback case, a pooled buffer) that has been sized for exactly one message.
+     * This works like Publisher::Loan. Loans are move-only, and must not outlive the publisher that they came from.
+     */
+    class Loan {
+        SharedMemoryPublisher *publisher = nullptr;
+        Ring *ring = nullptr;
+        uint32_t slot = 0;
+        uint64_t msg_size = 0;
+        uint8_t *data_ptr = nullptr;
+        uint8_t *payload_ptr = nullptr;
+        typename Publisher<Data>::Loan fallback;
+
+        friend class SharedMemoryPublisher;
+
+    public:
+        Loan() = default;
+        Loan(const Loan &) = delete;
+        Loan &operator=(const Loan &) = delete;
+        Loan(Loan &&other) noexcept { *this = std::move(other); }
+        Loan &operator=(Loan &&other) noexcept {
+            if (this != &other) {
+                reset();
+                std::swap(publisher, other.publisher);
+                std::swap(ring, other.ring);
+                std::swap(slot, other.slot);
+                std::swap(msg_size, other.msg_size);
+                std::swap(data_ptr, other.data_ptr);
+                std::swap(payload_ptr, other.payload_ptr);
+                fallback = std::move(other.fallback);
+            }
+            return *this;
+        }
+        ~Loan() { reset(); }
+
+        // The start of the message
+        [[nodiscard]] uint8_t *data() const { return data_ptr; }
+
+        // The size of the message, as requested when the loan was made
+        [[nodiscard]] size_t size() const { return msg_size; }
+
+        // Where the payload should be written. For an emplace loan, this is the end of the header.
+        [[nodiscard]] uint8_t *payload() const { return payload_ptr; }
+
+        // Publish the message. After this call, the loan is empty.
+        void send() {
+            if (ring) {
+                publisher->commit(ring, slot, msg_size);
+                ring = nullptr;
+            } else {
+                fallback.send();
+            }
+            publisher = nullptr;
+            data_ptr = nullptr;
+            payload_ptr = nullptr;
+        }
+
+    private:
+        void reset() {
+            if (ring) {
+                publisher->abandon(ring, slot);
+            }
+            publisher = nullptr;
+            ring = nullptr;
+            data_ptr = nullptr;
+            payload_ptr = nullptr;
+            fallback = typename Publisher<Data>::Loan();
+        }
+    };
+
+    /**
+     * Serve topic.port with a ring of slot_count slots, which are sized by the first message (and at least doubled
+     * whenever a message does not fit).
+     * The queue_depth and drop_policy apply to the wire format, exactly as they do for a Publisher.
+     * Note that a slot stays in use while its message waits in that queue, so slot_count should be at least
+     * the queue depth plus two.
+     */
+    explicit SharedMemoryPublisher(const Topic &topic, uint32_t slot_count = 4, size_t queue_depth = 1,
+                                   DropPolicy drop_policy = DropPolicy::DROP_OLDEST)
+        : SharedMemoryPublisher(topic, std::unique_ptr<PublisherExecutor>(new PublisherExecutor()), nullptr,
+                                slot_count, queue_depth, drop_policy) {}
+
+    /**
+     * Like the constructor above, but share the ZMQ context and the sender thread of an executor,
+     * which must outlive this publisher.
+     */
+    SharedMemoryPublisher(const Topic &topic, PublisherExecutor &executor, uint32_t slot_count = 4,
+                          size_t queue_depth = 1, DropPolicy drop_policy = DropPolicy::DROP_OLDEST)
+        : SharedMemoryPublisher(topic, nullptr, &executor, slot_count, queue_depth, drop_policy) {}
+
+private:
+    SharedMemoryPublisher(const Topic &topic, std::unique_ptr<PublisherExecutor> own_executor_arg,
+                          PublisherExecutor *shared_executor, uint32_t slot_count_arg, size_t queue_depth,
+                          DropPolicy drop_policy)
+        : own_executor(std::move(own_executor_arg)),
+          publisher(topic, "", own_executor ? *own_executor : *shared_executor, queue_depth, drop_policy),
+          port(topic.port),
+          slot_count(std::max<uint32_t>(slot_count_arg, 2)),
+          descriptor_socket((own_executor ? *own_executor : *shared_executor).getContext(), ZMQ_PUB) {
+        if (not ipcEnabled()) {
+            std::cerr << "ipc is disabled, so " << topic.name << " will not be published over shared memory."
+                      << std::endl;
+            return;
+        }
+        descriptor_socket.set(::zmq::sockopt::sndhwm, static_cast<int>(slot_count));
+        const auto endpoint = sharedMemoryEndpoint(port);
+        std::cout << "Binding shared memory publisher for " << topic.name << " on the endpoint " << endpoint
+                  << std::endl;
+        descriptor_socket.bind(endpoint);
+        descriptors_bound = true;
+    }
+
+public:
+    [[nodiscard]] PublisherStats stats() const { return publisher.stats(); }
+
+    // The number of messages that could not be written into shared memory, and were only sent in the wire format
+    [[nodiscard]] uint64_t fallbacks() const { return fallback_count; }
+
+    /**
+     * Serialize a message into a slot, and publish it.
+     */
+    void publish(const Data &data) {
+        auto loan = this->loan(data.msgSize());
+        data.write(loan.data());
+        loan.send();
+    }
+
+    /**
+     * Borrow a slot for a message of exactly msg_size bytes.
+     * Write the complete message into Loan::data(), and then call Loan::send().
+     */
+    Loan loan(uint64_t msg_size) {
+        Loan loan;
+        loan.publisher = this;
+        loan.msg_size = msg_size;
+        if (acquire(msg_size, loan.ring, loan.slot)) {
+            loan.data_ptr = loan.ring->segment->slot(loan.slot);
+        } else {
+            ++fallback_count;
+            loan.fallback = publisher.loan(msg_size);
+            loan.data_ptr = loan.fallback.data();
+        }
+        loan.payload_ptr = loan.data_ptr;
+        return loan;
+    }
+
+    /**
+     * Borrow a slot for a message of exactly msg_size bytes, and write the message header into it
+     * with Data::write_header(slot, header_args...). See Publisher::emplace.
+     */
+    template <typename... HeaderArgs>
+    Loan emplace(uint64_t msg_size, HeaderArgs &&...header_args) {
+        auto loan = this->loan(msg_size);
+        loan.payload_ptr = Data::write_header(loan.data(), std::forward<HeaderArgs>(header_args)...);
+        return loan;
+    }
+
+private:
+    // Find a slot that ZMQ is done with, mark it as being written, and pin it. Returns false if there is none.
+    bool acquire(uint64_t msg_size, Ring *&acquired_ring, uint32_t &acquired_slot) {
+        if (not descriptors_bound) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(guard);
+        auto &retired = rings.retired;
+        retired.erase(std::remove_if(retired.begin(), retired.end(),
+                                     [](const std::unique_ptr<Ring> &old) { return not old->pinned(); }),
+                      retired.end());
+        auto &ring = rings.current;
+        if (not ring or ring->segment->slotSize() < msg_size) {
+            // Grow the slots at least twofold, so that messages whose size varies do not recreate the ring every time
+            auto slot_size = msg_size;
+            if (ring) {
+                slot_size = std::max<uint64_t>(slot_size, 2 * ring->segment->slotSize());
+                // The new segment takes over the name, so the old one must not unlink it
+                ring->segment->disown();
+                retired.push_back(std::move(ring));
+            }
+            auto segment = SharedMemorySegment::create(sharedMemoryName(port), slot_count, slot_size);
+            if (not segment) {
+                return false;
+            }
+            ring.reset(new Ring{std::move(segment), std::unique_ptr<std::atomic<uint32_t>[]>(
+                                                        new std::atomic<uint32_t>[slot_count]()),
+                                0});
+        }
+        for (uint32_t i = 0; i < slot_count; ++i) {
+            const auto slot = (ring->next_slot + i) % slot_count;
+            if (ring->pins[slot].load(std::memory_order_acquire) == 0) {
+                ring->pins[slot].store(1, std::memory_order_relaxed);
+                ring->next_slot = (slot + 1) % slot_count;
+                // An odd generation tells the subscribers that the slot is being overwritten
+                auto &generation = ring->segment->state(slot)->generation;
+                generation.store(generation.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                acquired_ring = ring.get();
+                acquired_slot = slot;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Publish a written slot: send its descriptor to the local subscribers, and queue its wire format for everyone else
+    void commit(Ring *written_ring, uint32_t slot, uint64_t msg_size) {
+        auto &generation = written_ring->segment->state(slot)->generation;
+        SharedMemoryDescriptor descriptor;
+        descriptor.segment_id = written_ring->segment->segmentId();
+        descriptor.slot = slot;
+        descriptor.generation = generation.load(std::memory_order_relaxed) + 1;
+        descriptor.size = msg_size;
+        generation.store(descriptor.generation, std::memory_order_release);
+        {
+            ::zmq::message_t msg(SharedMemoryDescriptor::MSG_SIZE);
+            descriptor.write(static_cast<uint8_t *>(msg.data()));
+            std::lock_guard<std::mutex> lock(guard);
+            descriptor_socket.send(msg, ::zmq::send_flags::dontwait);
+        }
+        // The loan's pin is handed over to the frame, which is released once ZMQ is done with it (or it is dropped)
+        publisher.send({Frame(written_ring->segment->slot(slot), msg_size, unpin, &written_ring->pins[slot])});
+    }
+
+    // Give back a slot that was never sent
+    void abandon(Ring *written_ring, uint32_t slot) {
+        auto &generation = written_ring->segment->state(slot)->generation;
+        generation.store(generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        unpin(nullptr, &written_ring->pins[slot]);
+    }
+};
+
+/**
+ * Receive the messages that a SharedMemoryPublisher on this host publishes on a port, and read them in place.
+ * Check sharedMemoryAvailable first, and fall back to a regular subscriber if it returns false.
+ */
+class SharedMemorySubscriber {
+public:
+    SharedMemorySubscriber(::zmq::context_t &context, uint16_t port_arg)
+        : port(port_arg), socket(context, ZMQ_SUB) {
+        socket.set(::zmq::sockopt::subscribe, "");
+        const auto endpoint = sharedMemoryEndpoint(port);
+        socket.connect(endpoint);
+        std::cout << "Subscribing to " << endpoint << std::endl;
+    }
+
+    // The socket over which descriptors arrive, e.g. to set a receive timeout, or to poll it
+    ::zmq::socket_t &getSocket() { return socket; }
+
+    /**
+     * Receive the next descriptor, and return a view of its message.
+     * The message is empty if nothing was received, or if its slot had already been reused by the time it was mapped.
+     */
+    SharedMemoryMessage recv(::zmq::recv_flags flags = ::zmq::recv_flags::none) {
+        ::zmq::message_t msg;
+        if (not socket.recv(msg, flags)) {
+            return {};
+        }
+        SharedMemoryDescriptor descriptor;
+        if (not descriptor.read(static_cast<const uint8_t *>(msg.data()), msg.size())) {
+            return {};
+        }
+        if (not segment or segment->segmentId() != descriptor.segment_id) {
+            // The producer started, restarted, or grew its ring. Views of the old mapping keep it alive.
+            segment = SharedMemorySegment::open(sharedMemoryName(port));
+            if (not segment or segment->segmentId() != descriptor.segment_id) {
+                segment.reset();
+                return {};
+            }
+        }
+        if (descriptor.slot >= segment->slotCount() or descriptor.size > segment->slotSize()) {
+            std::cerr << "The shared memory descriptor points outside of the ring." << std::endl;
+            return {};
+        }
+        SharedMemoryMessage message;
+        message.data = Span<const uint8_t>(segment->slot(descriptor.slot), descriptor.size);
+        message.owner = segment;
+        message.generation = &segment->state(descriptor.slot)->generation;
+        message.expected_generation = descriptor.generation;
+        if (message.generation->load(std::memory_order_acquire) != descriptor.generation) {
+            ++overwritten_count;
+            return {};
+        }
+        return message;
+    }
+
+    // The number of messages whose slot was reused before they could be read
+    [[nodiscard]] uint64_t overwritten() const { return overwritten_count; }
+
+private:
+    uint16_t port;
+    ::zmq::socket_t socket;
+    std::shared_ptr<SharedMemorySegment> segment;
+    uint64_t overwritten_count = 0;
+};
+
+}  // namespace zmq
+}  // namespace nodar
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+
+namespace nodar {
+namespace zmq {
+
+/**
+ * A minimal non-owning view of a contiguous block of memory.
+ * This is a stand-in for std::span, which is only available from C++20 onwards.
+ * Under C++20, a Span converts implicitly to the equivalent std::span.
+ */
+template <typename T>
+class Span {
+    T* ptr = nullptr;
+    size_t count = 0;
+
+public:
+    constexpr Span() = default;
+
+    constexpr Span(T* data, size_t size) : ptr(data), count(size) {}
+
+    [[nodiscard]] constexpr T* data() const { return ptr; }
+
+    [[nodiscard]] constexpr size_t size() const { return count; }
+
+    [[nodiscard]] constexpr size_t size_bytes() const { return count * sizeof(T); }
+
+    [[nodiscard]] constexpr bool empty() const { return count == 0; }
+
+    [[nodiscard]] constexpr T* begin() const { return ptr; }
+
+    [[nodiscard]] constexpr T* end() const { return ptr + count; }
+
+    constexpr T& operator[](size_t i) const { return ptr[i]; }
+
+#if __cplusplus >= 202002L
+    constexpr operator std::span<T>() const { return {ptr, count}; }
+#endif
+};
+
+}  // namespace zmq
+}  // namespace nodar
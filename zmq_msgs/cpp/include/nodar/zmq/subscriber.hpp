@@ -0,0 +1,290 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <nodar/zmq/topic_ports.hpp>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <zmq.hpp>
+
+#include "endpoint.hpp"
+#include "frame_stats.hpp"
+#include "message_info.hpp"
+#include "multipart.hpp"
+#include "multiplexer.hpp"
+#include "utils.hpp"
+
+namespace nodar {
+namespace zmq {
+
+struct SubscriberStats {
+    uint64_t received{0};  // Number of messages received and decoded
+    uint64_t frames_dropped{0};  // Number of frame IDs that never arrived (only counted if Data has a frame_id)
+    uint64_t overwritten{0};  // Number of messages that were replaced by a newer one before waitForNext took them
+};
+
+namespace detail {
+
+template <typename Data, typename = void>
+struct HasFrameId : std::false_type {};
+
+template <typename Data>
+struct HasFrameId<Data, decltype(void(std::declval<const Data &>().frame_id))> : std::true_type {};
+
+// Record a message in stats, and return the number of frames between the last frame and this one that never arrived
+template <typename Data>
+uint64_t recordFrame(FrameStats &stats, const Data &data, size_t bytes, std::true_type) {
+    return stats.record(data, bytes);
+}
+
+template <typename Data>
+uint64_t recordFrame(FrameStats &, const Data &, size_t, std::false_type) {
+    return 0;
+}
+
+template <typename Data, typename = void>
+struct HasGetInfo : std::false_type {};
+
+template <typename Data>
+struct HasGetInfo<Data, decltype(void(Data::getInfo()))> : std::true_type {};
+
+// Check the MessageInfo at the start of a message before decoding it, so that a bad message is dropped,
+// rather than being decoded over (and mixed up with) the previous contents of a pooled message object
+template <typename Data>
+bool isExpectedMessage(const ::zmq::message_t &msg, std::true_type) {
+    MessageInfo info;
+    if (msg.size() < sizeof(info)) {
+        std::cerr << "The message is too small to contain any data." << std::endl;
+        return false;
+    }
+    utils::read(static_cast<const uint8_t *>(msg.data()), info);
+    if (info != Data::getInfo()) {
+        std::cerr << "This message either is not of the subscribed type, or is a different message version."
+                  << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <typename Data>
+bool isExpectedMessage(const ::zmq::message_t &msg, std::false_type) {
+    return msg.size() > 0;
+}
+
+}  // namespace detail
+
+/**
+ * The receiving counterpart of Publisher.
+ *
+ * A background thread receives the messages of one topic, and decodes each of them (with Data::read) into a message
+ * object that is taken from a pool, so that a steady stream of same-sized messages does not allocate.
+ * Receiving and decoding therefore overlap with whatever the consumer does with the previous message.
+ * Messages are handed out as std::shared_ptr<const Data>, and go back to the pool once the last copy is released.
+ *
+ * There are two ways to consume the messages, which can be combined:
+ * - Poll or wait for the newest message with latest() or waitForNext(). Messages that arrive while the consumer is
+ *   busy replace each other, so the consumer always gets the freshest one (see SubscriberStats::overwritten).
+ * - Pass a callback, which is called on the receive thread with every message.
+ *   Keep the callback short, since the next message is not received until it returns.
+ *
+ * Single-part and multipart messages (see multipart.hpp) are both accepted.
+ * Pass MULTIPLEXED to receive the topic from the multiplexed port of the device instead (see Multiplexer).
+ */
+template <typename Data>
+class Subscriber {
+public:
+    using Message = std::shared_ptr<const Data>;
+    using Callback = std::function<void(const Message &)>;
+
+    /**
+     * Subscribe to topic on the device with the given IP address (see connectEndpoint).
+     * This subscriber gets its own ZMQ context. To share one, e.g. to use inproc, use the constructor below.
+     */
+    Subscriber(const Topic &topic, const std::string &ip, Callback callback = nullptr)
+        : Subscriber(topic, ip, std::unique_ptr<::zmq::context_t>(new ::zmq::context_t(1)), nullptr, false,
+                     std::move(callback)) {}
+
+    // Like the constructor above, but use a context that must outlive this subscriber
+    Subscriber(const Topic &topic, const std::string &ip, ::zmq::context_t &context, Callback callback = nullptr)
+        : Subscriber(topic, ip, nullptr, &context, false, std::move(callback)) {}
+
+    // Subscribe to topic on the multiplexed port of the device with the given IP address (see Multiplexer)
+    Subscriber(const Topic &topic, const std::string &ip, Multiplexed, Callback callback = nullptr)
+        : Subscriber(topic, ip, std::unique_ptr<::zmq::context_t>(new ::zmq::context_t(1)), nullptr, true,
+                     std::move(callback)) {}
+
+private:
+    Subscriber(const Topic &topic, const std::string &ip, std::unique_ptr<::zmq::context_t> own_context_arg,
+               ::zmq::context_t *shared_context, bool multiplexed_arg, Callback callback_arg)
+        : own_context(std::move(own_context_arg)),
+          socket(own_context ? *own_context : *shared_context, ZMQ_SUB),
+          multiplexed(multiplexed_arg),
+          callback(std::move(callback_arg)),
+          pool(std::make_shared<Pool>()),
+          running(true),
+          frame_stats(topic.name) {
+        const int hwm = 1;  // set maximum queue length to 1 message
+        socket.set(::zmq::sockopt::rcvhwm, hwm);
+        // Wake up regularly, so that the receive thread notices when it should stop
+        socket.set(::zmq::sockopt::rcvtimeo, static_cast<int>(RECEIVE_TIMEOUT.count()));
+        // A multiplexed socket carries many topics, so only subscribe to the routing frame of this one
+        socket.set(::zmq::sockopt::subscribe, multiplexed ? routingFrame(topic) : std::string());
+        const auto endpoint = connectEndpoint(ip, multiplexed ? MULTIPLEXED_TOPIC : topic);
+        socket.connect(endpoint);
+        std::cout << "Subscribing to " << topic.name << " on the endpoint " << endpoint << std::endl;
+        receive_thread = std::thread(&Subscriber::loop, this);
+    }
+
+public:
+    Subscriber(const Subscriber &) = delete;
+    Subscriber &operator=(const Subscriber &) = delete;
+
+    ~Subscriber() {
+        {
+            std::lock_guard<std::mutex> lock(guard);
+            running = false;
+        }
+        message_available.notify_all();
+        if (receive_thread.joinable()) {
+            receive_thread.join();
+        }
+    }
+
+    // The newest message that was received, or nullptr if nothing has been received yet
+    [[nodiscard]] Message latest() const {
+        std::lock_guard<std::mutex> lock(guard);
+        return newest;
+    }
+
+    /**
+     * Wait for a message that has not been returned by waitForNext yet, and return it.
+     * If several messages arrived since the last call, then only the newest one is returned.
+     * Returns nullptr if nothing arrived within the timeout, or if the subscriber is being destroyed.
+     */
+    Message waitForNext(std::chrono::milliseconds timeout = std::chrono::milliseconds(100)) {
+        std::unique_lock<std::mutex> lock(guard);
+        if (not message_available.wait_for(lock, timeout, [this] { return not newest_taken or not running; }) or
+            newest_taken) {
+            return nullptr;
+        }
+        newest_taken = true;
+        return newest;
+    }
+
+    [[nodiscard]] SubscriberStats stats() const {
+        std::lock_guard<std::mutex> lock(guard);
+        return subscriber_stats;
+    }
+
+    // Latency, inter-arrival and size histograms of the received messages (only recorded if Data has a frame_id)
+    [[nodiscard]] const FrameStats &frameStats() const { return frame_stats; }
+
+private:
+    static constexpr std::chrono::milliseconds RECEIVE_TIMEOUT{100};
+
+    // Message objects that are ready to be decoded into. Every message holds a reference to the pool,
+    // so that the pool outlives the subscriber if the consumer keeps a message around for longer.
+    class Pool : public std::enable_shared_from_this<Pool> {
+        std::mutex guard;
+        std::vector<std::unique_ptr<Data>> available;
+
+    public:
+        std::unique_ptr<Data> get() {
+            {
+                std::lock_guard<std::mutex> lock(guard);
+                if (not available.empty()) {
+                    auto data = std::move(available.back());
+                    available.pop_back();
+                    return data;
+                }
+            }
+            return std::unique_ptr<Data>(new Data());
+        }
+
+        Message share(std::unique_ptr<Data> data) {
+            auto self = this->shared_from_this();
+            return Message(data.release(), [self](const Data *released) {
+                std::lock_guard<std::mutex> lock(self->guard);
+                self->available.emplace_back(const_cast<Data *>(released));
+            });
+        }
+    };
+
+    std::unique_ptr<::zmq::context_t> own_context;
+    ::zmq::socket_t socket;
+    const bool multiplexed;
+    Callback callback;
+    std::shared_ptr<Pool> pool;
+    mutable std::mutex guard;
+    std::condition_variable message_available;
+    bool running;
+    Message newest;
+    bool newest_taken = true;
+    SubscriberStats subscriber_stats;
+    FrameStats frame_stats;
+    std::thread receive_thread;
+
+    void loop() {
+        std::vector<::zmq::message_t> frames;
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock(guard);
+                if (not running) {
+                    break;
+                }
+            }
+            try {
+                if (not recvFrames(socket, frames)) {
+                    continue;
+                }
+            } catch (const ::zmq::error_t &error) {
+                // A signal (EINTR) just ends the receive early, so that running is checked again
+                if (error.num() == EINTR) {
+                    continue;
+                }
+                std::cerr << "Receiving a message failed: " << error.what() << std::endl;
+                break;
+            }
+            if (multiplexed) {
+                // Drop the routing frame
+                frames.erase(frames.begin());
+            }
+            const auto msg = reassemble(frames);
+            if (not detail::isExpectedMessage<Data>(msg, detail::HasGetInfo<Data>())) {
+                continue;
+            }
+            auto data = pool->get();
+            data->read(static_cast<const uint8_t *>(msg.data()));
+            const auto skipped = detail::recordFrame(frame_stats, *data, msg.size(), detail::HasFrameId<Data>());
+            const auto message = pool->share(std::move(data));
+            {
+                std::lock_guard<std::mutex> lock(guard);
+                ++subscriber_stats.received;
+                subscriber_stats.frames_dropped += skipped;
+                if (not newest_taken) {
+                    ++subscriber_stats.overwritten;
+                }
+                newest = message;
+                newest_taken = false;
+            }
+            message_available.notify_all();
+            if (callback) {
+                callback(message);
+            }
+        }
+    }
+};
+
+template <typename Data>
+constexpr std::chrono::milliseconds Subscriber<Data>::RECEIVE_TIMEOUT;
+
+}  // namespace zmq
+}  // namespace nodar
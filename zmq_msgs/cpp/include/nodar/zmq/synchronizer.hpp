@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <nodar/zmq/topic_ports.hpp>
+#include <tuple>
+#include <utility>
+#include <zmq.hpp>
+
+#include "subscriber.hpp"
+
+namespace nodar {
+namespace zmq {
+
+enum class SyncPolicy {
+    EXACT_FRAME_ID,  // Only match messages with the same frame_id
+    APPROXIMATE_TIME,  // Match messages whose times (in ns) are all within the tolerance of each other
+};
+
+struct SynchronizerStats {
+    uint64_t matched{0};  // Number of matches that were emitted
+    uint64_t unmatched{0};  // Number of messages that were dropped, because the other topics had no match for them
+    uint64_t overflowed{0};  // Number of messages that were dropped, because the queue of their topic was full
+    uint64_t overwritten{0};  // Number of matches that were replaced by a newer one before waitForNext took them
+};
+
+/**
+ * Subscribe to several topics, and emit a tuple with one message of each topic whenever they match,
+ * e.g. the LEFT_RECT_TOPIC, DISPARITY_TOPIC and CONFIDENCE_MAP_TOPIC images of the same frame:
+ *
+ *     using Images = nodar::zmq::Synchronizer<StampedImage, StampedImage, StampedImage>;
+ *     Images sync({{LEFT_RECT_TOPIC, DISPARITY_TOPIC, CONFIDENCE_MAP_TOPIC}}, ip, SyncPolicy::EXACT_FRAME_ID);
+ *     Images::Match match;
+ *     while (running) {
+ *         if (sync.waitForNext(match)) {
+ *             const auto &left = *std::get<0>(match);
+ *             ...
+ *         }
+ *     }
+ *
+ * Every Data type needs a frame_id and a time (e.g. StampedImage, ObstacleData, QAFindings).
+ * Each topic is received and decoded by its own Subscriber, and kept in a queue of at most queue_size messages.
+ * Since every topic is published in order, the oldest message of the topic that is furthest behind can never be
+ * matched once it is further from the newest of the oldest messages than the tolerance, so it is dropped.
+ * When a topic stalls, the queues of the other topics drop their oldest messages instead of growing,
+ * so the memory that the synchronizer uses stays bounded whatever the publishers do.
+ * If the frame IDs or times of a topic go backwards (e.g. because Hammerhead was restarted), then every queue is
+ * cleared, so that the old messages do not block the new ones.
+ *
+ * As with Subscriber, matches can be polled with latest() / waitForNext(), and/or passed to a callback.
+ * The callback is called with every match in order, on the receive thread of the topic that completed it.
+ */
+template <typename... Data>
+class Synchronizer {
+public:
+    static constexpr size_t TOPIC_COUNT = sizeof...(Data);
+    using Match = std::tuple<std::shared_ptr<const Data>...>;
+    using Callback = std::function<void(const Match &)>;
+
+    Synchronizer(const std::array<Topic, sizeof...(Data)> &topics, const std::string &ip,
+                 SyncPolicy policy_arg = SyncPolicy::EXACT_FRAME_ID,
+                 std::chrono::nanoseconds tolerance_arg = std::chrono::nanoseconds(0), size_t queue_size_arg = 8,
+                 Callback callback_arg = nullptr)
+        : policy(policy_arg),
+          tolerance(policy == SyncPolicy::EXACT_FRAME_ID ? 0 : static_cast<uint64_t>(tolerance_arg.count())),
+          queue_size(std::max<size_t>(queue_size_arg, 1)),
+          callback(std::move(callback_arg)),
+          subscribers(makeSubscribers(topics, ip, std::index_sequence_for<Data...>())) {}
+
+    Synchronizer(const Synchronizer &) = delete;
+    Synchronizer &operator=(const Synchronizer &) = delete;
+
+    ~Synchronizer() {
+        {
+            std::lock_guard<std::mutex> lock(guard);
+            running = false;
+        }
+        match_available.notify_all();
+    }
+
+    // The newest match, or a tuple of nullptrs if nothing has been matched yet
+    [[nodiscard]] Match latest() const {
+        std::lock_guard<std::mutex> lock(guard);
+        return newest;
+    }
+
+    /**
+     * Wait for a match that has not been returned by waitForNext yet, and store it in match.
+     * If several matches were made since the last call, then only the newest one is returned.
+     * Returns false if nothing was matched within the timeout, or if the synchronizer is being destroyed.
+     */
+    bool waitForNext(Match &match, std::chrono::milliseconds timeout = std::chrono::milliseconds(100)) {
+        std::unique_lock<std::mutex> lock(guard);
+        if (not match_available.wait_for(lock, timeout, [this] { return not newest_taken or not running; }) or
+            newest_taken) {
+            return false;
+        }
+        newest_taken = true;
+        match = newest;
+        return true;
+    }
+
+    [[nodiscard]] SynchronizerStats stats() const {
+        std::lock_guard<std::mutex> lock(guard);
+        return synchronizer_stats;
+    }
+
+private:
+    template <typename Message>
+    using Queue = std::deque<std::pair<uint64_t, Message>>;
+
+    const SyncPolicy policy;
+    const uint64_t tolerance;
+    const size_t queue_size;
+    Callback callback;
+    ::zmq::context_t context{1};
+
+    mutable std::mutex guard;
+    std::condition_variable match_available;
+    bool running = true;
+    std::tuple<Queue<std::shared_ptr<const Data>>...> queues;
+    Match newest;
+    bool newest_taken = true;
+    SynchronizerStats synchronizer_stats;
+    std::deque<Match> undelivered;  // Matches that have not been passed to the callback yet
+    std::mutex delivering;
+
+    // Declared last, so that the receive threads are stopped before anything that they use is destroyed
+    std::tuple<std::unique_ptr<Subscriber<Data>>...> subscribers;
+
+    template <size_t... I>
+    std::tuple<std::unique_ptr<Subscriber<Data>>...> makeSubscribers(const std::array<Topic, sizeof...(Data)> &topics,
+                                                                      const std::string &ip,
+                                                                      std::index_sequence<I...>) {
+        return std::make_tuple(std::unique_ptr<Subscriber<Data>>(new Subscriber<Data>(
+            topics[I], ip, context, [this](const std::shared_ptr<const Data> &message) { add<I>(message); }))...);
+    }
+
+    // Call f(queue, index) for the queue of every topic
+    template <typename F, size_t... I>
+    void forEachQueue(F &&f, std::index_sequence<I...>) {
+        (void)std::initializer_list<int>{(f(std::get<I>(queues), I), 0)...};
+    }
+
+    template <typename F>
+    void forEachQueue(F &&f) {
+        forEachQueue(std::forward<F>(f), std::index_sequence_for<Data...>());
+    }
+
+    template <size_t... I>
+    Match oldest(std::index_sequence<I...>) const {
+        return Match(std::get<I>(queues).front().second...);
+    }
+
+    template <typename Message>
+    uint64_t key(const Message &message) const {
+        return policy == SyncPolicy::EXACT_FRAME_ID ? static_cast<uint64_t>(message->frame_id)
+                                                    : static_cast<uint64_t>(message->time);
+    }
+
+    template <size_t I, typename Message>
+    void add(const Message &message) {
+        {
+            std::lock_guard<std::mutex> lock(guard);
+            const auto message_key = key(message);
+            auto &queue = std::get<I>(queues);
+            if (not queue.empty() and message_key < queue.back().first) {
+                forEachQueue([this](auto &stale, size_t) {
+                    synchronizer_stats.unmatched += stale.size();
+                    stale.clear();
+                });
+            }
+            if (queue.size() >= queue_size) {
+                queue.pop_front();
+                ++synchronizer_stats.overflowed;
+            }
+            queue.emplace_back(message_key, message);
+            // Before this message arrived, nothing could be matched, so this is the only match it can complete
+            if (not match()) {
+                return;
+            }
+        }
+        match_available.notify_all();
+        deliver();
+    }
+
+    // Drop the messages that can no longer be matched, and emit a match if there is one. Call with guard held.
+    bool match() {
+        std::array<uint64_t, sizeof...(Data)> keys{};
+        for (;;) {
+            bool complete = true;
+            forEachQueue([&](const auto &queue, size_t i) {
+                if (queue.empty()) {
+                    complete = false;
+                } else {
+                    keys[i] = queue.front().first;
+                }
+            });
+            if (not complete) {
+                return false;
+            }
+            const auto range = std::minmax_element(keys.begin(), keys.end());
+            if (*range.second - *range.first <= tolerance) {
+                break;
+            }
+            const auto behind = static_cast<size_t>(range.first - keys.begin());
+            forEachQueue([behind](auto &queue, size_t i) {
+                if (i == behind) {
+                    queue.pop_front();
+                }
+            });
+            ++synchronizer_stats.unmatched;
+        }
+
+        ++synchronizer_stats.matched;
+        if (not newest_taken) {
+            ++synchronizer_stats.overwritten;
+        }
+        newest = oldest(std::index_sequence_for<Data...>());
+        newest_taken = false;
+        forEachQueue([](auto &queue, size_t) { queue.pop_front(); });
+        if (callback) {
+            undelivered.push_back(newest);
+        }
+        return true;
+    }
+
+    // Pass the undelivered matches to the callback in order, even if several receive threads complete matches at once
+    void deliver() {
+        if (not callback) {
+            return;
+        }
+        std::lock_guard<std::mutex> delivery(delivering);
+        for (;;) {
+            Match next;
+            {
+                std::lock_guard<std::mutex> lock(guard);
+                if (undelivered.empty()) {
+                    return;
+                }
+                next = std::move(undelivered.front());
+                undelivered.pop_front();
+            }
+            callback(next);
+        }
+    }
+};
+
+template <typename... Data>
+constexpr size_t Synchronizer<Data...>::TOPIC_COUNT;
+
+}  // namespace zmq
+}  // namespace nodar
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <nodar/zmq/topic_ports.hpp>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <zmq.hpp>
+
+#include "endpoint.hpp"
+#include "multipart.hpp"
+#include "multiplexer.hpp"
+#include "subscriber.hpp"
+
+namespace nodar {
+namespace zmq {
+
+// The longest that TopicLoop::run waits before it checks whether it should stop
+constexpr std::chrono::milliseconds TOPIC_LOOP_MAX_WAIT{100};
+
+/**
+ * A single-threaded event loop that services many topics and timers.
+ *
+ * All the subscribed sockets are polled together with zmq_poll, and every message that arrives is decoded
+ * (with Data::read) and handed to the handler of its topic, on the thread that runs the loop.
+ * So one thread can service all the low-rate topics (e.g. obstacles and QA findings, or the images of a viewer),
+ * and the handlers never need any locking. Each topic decodes into one message object that is reused,
+ * so the reference that a handler gets is only valid until the handler returns. Copy what you need to keep.
+ * Subscribe with StampedImageView as Data to view images in the received frames instead of decoding them
+ * (see viewStampedImage), e.g. to monitor a stream of large images without copying each one.
+ *
+ * The loop wakes up at least every TOPIC_LOOP_MAX_WAIT, so run(running) returns promptly once running is cleared,
+ * e.g. by a SIGINT handler, rather than staying blocked in a recv.
+ *
+ *     nodar::zmq::TopicLoop loop;
+ *     loop.subscribe<nodar::zmq::ObstacleData>(nodar::zmq::OBSTACLE_TOPIC, ip, [](const auto &obstacles) {...});
+ *     loop.subscribe<nodar::zmq::QAFindings>(nodar::zmq::QA_FINDINGS_TOPIC, ip, [](const auto &findings) {...});
+ *     loop.addTimer(std::chrono::seconds(1), [] { std::cout << "tick" << std::endl; });
+ *     loop.run(running);
+ */
+class TopicLoop {
+public:
+    using TimerId = size_t;
+
+    TopicLoop() : own_context(new ::zmq::context_t(1)), context(*own_context) {}
+
+    // Use a context that must outlive this loop, e.g. to subscribe to inproc endpoints
+    explicit TopicLoop(::zmq::context_t &context_arg) : context(context_arg) {}
+
+    TopicLoop(const TopicLoop &) = delete;
+    TopicLoop &operator=(const TopicLoop &) = delete;
+
+    /**
+     * Subscribe to topic on the device with the given IP address (see connectEndpoint),
+     * and call handler with every message that arrives on it.
+     * The socket keeps at most queue_depth messages that the loop has not gotten to yet.
+     */
+    template <typename Data>
+    void subscribe(const Topic &topic, const std::string &ip, std::function<void(const Data &)> handler,
+                   int queue_depth = 1) {
+        std::unique_ptr<Subscription> entry(new Subscription(context));
+        entry->socket.set(::zmq::sockopt::rcvhwm, queue_depth);
+        entry->socket.set(::zmq::sockopt::subscribe, "");
+        const auto endpoint = connectEndpoint(ip, topic);
+        entry->socket.connect(endpoint);
+        std::cout << "Subscribing to " << topic.name << " on the endpoint " << endpoint << std::endl;
+        entry->dispatch = makeDispatch(std::move(handler));
+        topics.push_back(std::move(entry));
+        items.push_back({topics.back()->socket.handle(), 0, ZMQ_POLLIN, 0});
+    }
+
+    /**
+     * Like subscribe, but receive topic from the multiplexed port of the device (see Multiplexer).
+     * All the multiplexed topics of a device share one socket, and so one connection, which only carries the topics
+     * that were subscribed to. Since they share a queue, queue_depth should leave room for a message of each topic.
+     */
+    template <typename Data>
+    void subscribeMultiplexed(const Topic &topic, const std::string &ip, std::function<void(const Data &)> handler,
+                              int queue_depth = 16) {
+        const auto endpoint = connectEndpoint(ip, MULTIPLEXED_TOPIC);
+        auto it = std::find_if(topics.begin(), topics.end(), [&endpoint](const std::unique_ptr<Subscription> &entry) {
+            return entry->multiplexed_endpoint == endpoint;
+        });
+        if (it == topics.end()) {
+            std::unique_ptr<Subscription> entry(new Subscription(context));
+            entry->socket.set(::zmq::sockopt::rcvhwm, queue_depth);
+            entry->socket.connect(endpoint);
+            entry->multiplexed_endpoint = endpoint;
+            topics.push_back(std::move(entry));
+            items.push_back({topics.back()->socket.handle(), 0, ZMQ_POLLIN, 0});
+            it = topics.end() - 1;
+        }
+        const auto route = routingFrame(topic);
+        (*it)->socket.set(::zmq::sockopt::subscribe, route);
+        (*it)->routes[route] = makeDispatch(std::move(handler));
+        std::cout << "Subscribing to " << topic.name << " on the multiplexed endpoint " << endpoint << std::endl;
+    }
+
+    /**
+     * Call callback every period (of at least a millisecond), starting one period from now.
+     * Timers run on the loop thread, between messages, so a slow handler delays them (but they never pile up).
+     */
+    TimerId addTimer(std::chrono::milliseconds period, std::function<void()> callback) {
+        period = std::max(period, std::chrono::milliseconds(1));
+        timers.push_back({next_timer_id, period, Clock::now() + period, std::move(callback)});
+        return next_timer_id++;
+    }
+
+    void cancelTimer(TimerId id) {
+        timers.erase(std::remove_if(timers.begin(), timers.end(), [id](const Timer &timer) { return timer.id == id; }),
+                     timers.end());
+    }
+
+    // Run until running is cleared, or until stop() is called (e.g. from a handler)
+    void run(const std::atomic_bool &running) {
+        stopped = false;
+        while (running and not stopped) {
+            runOnce(TOPIC_LOOP_MAX_WAIT);
+        }
+    }
+
+    void stop() { stopped = true; }
+
+    /**
+     * Wait for up to max_wait (or until the next timer is due), then handle every message that has arrived,
+     * and fire every timer that is due. Returns the number of messages that were handled.
+     */
+    size_t runOnce(std::chrono::milliseconds max_wait = TOPIC_LOOP_MAX_WAIT) {
+        auto wait = max_wait;
+        const auto now = Clock::now();
+        for (const auto &timer : timers) {
+            wait = std::min(wait, std::max(std::chrono::duration_cast<std::chrono::milliseconds>(timer.due - now),
+                                           std::chrono::milliseconds(0)));
+        }
+
+        size_t handled = 0;
+        if (poll(wait) > 0) {
+            for (size_t i = 0; i < items.size(); ++i) {
+                if (items[i].revents & ZMQ_POLLIN) {
+                    handled += drain(*topics[i]);
+                }
+            }
+        }
+        fireTimers();
+        return handled;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Called with the frames of every message, without the routing frame
+    using Dispatch = std::function<void(std::vector<::zmq::message_t> &)>;
+
+    // One subscribed topic, or all the multiplexed topics of one device
+    struct Subscription {
+        ::zmq::socket_t socket;
+        Dispatch dispatch;
+        // Only used for multiplexed topics, which are dispatched by their routing frames
+        std::string multiplexed_endpoint;
+        std::map<std::string, Dispatch> routes;
+
+        explicit Subscription(::zmq::context_t &context) : socket(context, ZMQ_SUB) {}
+    };
+
+    struct Timer {
+        TimerId id;
+        std::chrono::milliseconds period;
+        Clock::time_point due;
+        std::function<void()> callback;
+    };
+
+    std::unique_ptr<::zmq::context_t> own_context;
+    ::zmq::context_t &context;
+    std::vector<std::unique_ptr<Subscription>> topics;
+    std::vector<::zmq::pollitem_t> items;
+    std::vector<Timer> timers;
+    TimerId next_timer_id = 0;
+    bool stopped = false;
+    std::vector<::zmq::message_t> frames;
+    std::string route_key;  // Reused, so that looking up a routing frame does not allocate
+
+    // Returns the number of sockets that are readable. A signal (EINTR) just ends the wait early.
+    int poll(std::chrono::milliseconds wait) {
+        if (items.empty()) {
+            std::this_thread::sleep_for(wait);
+            return 0;
+        }
+        try {
+            return ::zmq::poll(items.data(), items.size(), static_cast<long>(wait.count()));
+        } catch (const ::zmq::error_t &error) {
+            if (error.num() != EINTR) {
+                std::cerr << "Polling the subscribed topics failed: " << error.what() << std::endl;
+            }
+            return 0;
+        }
+    }
+
+    // Decode each message into one message object that is reused, and pass it to handler
+    template <typename Data>
+    static Dispatch makeDispatch(std::function<void(const Data &)> handler) {
+        auto data = std::make_shared<Data>();
+        return [data, handler](std::vector<::zmq::message_t> &frames) {
+            const auto msg = reassemble(frames);
+            if (not detail::isExpectedMessage<Data>(msg, detail::HasGetInfo<Data>())) {
+                return;
+            }
+            data->read(static_cast<const uint8_t *>(msg.data()));
+            handler(*data);
+        };
+    }
+
+    // View each image in place, so that the frames are neither reassembled nor decoded
+    static Dispatch makeDispatch(std::function<void(const StampedImageView &)> handler) {
+        return [handler](std::vector<::zmq::message_t> &frames) {
+            const auto view = viewStampedImage(frames);
+            if (view.empty()) {
+                return;
+            }
+            handler(view);
+        };
+    }
+
+    // Handle every message that is waiting on a topic
+    size_t drain(Subscription &topic) {
+        size_t handled = 0;
+        while (recvFrames(topic.socket, frames, ::zmq::recv_flags::dontwait)) {
+            if (topic.multiplexed_endpoint.empty()) {
+                topic.dispatch(frames);
+            } else {
+                route_key.assign(static_cast<const char *>(frames.front().data()), frames.front().size());
+                const auto route = topic.routes.find(route_key);
+                if (route == topic.routes.end()) {
+                    continue;
+                }
+                frames.erase(frames.begin());
+                route->second(frames);
+            }
+            ++handled;
+        }
+        return handled;
+    }
+
+    void fireTimers() {
+        const auto now = Clock::now();
+        // Callbacks may add or cancel timers, so look each timer up by index, and never hold on to a reference
+        for (size_t i = 0; i < timers.size(); ++i) {
+            if (timers[i].due > now) {
+                continue;
+            }
+            // Skip the periods that were missed, rather than firing once for each of them
+            while (timers[i].due <= now) {
+                timers[i].due += timers[i].period;
+            }
+            const auto callback = timers[i].callback;
+            callback();
+        }
+    }
+};
+
+}  // namespace zmq
+}  // namespace nodar
@@ -54,6 +54,12 @@ constexpr Topic QA_FINDINGS_TOPIC{"nodar/qa_findings", 9822};
 
 constexpr Topic NAVIGATION_TOPIC{"nodar/navigation", 9824};
 
+// Clock sync requests and replies (see clock_sync.hpp), rather than a stream of messages
+constexpr Topic CLOCK_SYNC_TOPIC{"nodar/clock_sync", 9825};
+
+// Many topics on one port, each message led by a routing frame with the name of its topic (see multiplexer.hpp)
+constexpr Topic MULTIPLEXED_TOPIC{"nodar/multiplexed", 9826};
+
 // Function to retrieve reserved ports dynamically
 inline auto getReservedPorts() {
     std::set<uint16_t> reserved_ports;
@@ -70,6 +76,8 @@ inline auto getReservedPorts() {
     reserved_ports.insert(nodar::zmq::WAIT_TOPIC.port);
     reserved_ports.insert(nodar::zmq::QA_FINDINGS_TOPIC.port);
     reserved_ports.insert(nodar::zmq::NAVIGATION_TOPIC.port);
+    reserved_ports.insert(nodar::zmq::CLOCK_SYNC_TOPIC.port);
+    reserved_ports.insert(nodar::zmq::MULTIPLEXED_TOPIC.port);
     return reserved_ports;
 }
 
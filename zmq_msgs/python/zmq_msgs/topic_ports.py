@@ -36,6 +36,10 @@ OBSTACLE_TOPIC = Topic("nodar/obstacle", 9812)
 WAIT_TOPIC = Topic("nodar/wait", 9814)
 QA_FINDINGS_TOPIC = Topic("nodar/qa_findings", 9822)
 NAVIGATION_TOPIC = Topic("nodar/navigation", 9824)
+# Clock sync requests and replies, rather than a stream of messages
+CLOCK_SYNC_TOPIC = Topic("nodar/clock_sync", 9825)
+# Many topics on one port, each message led by a routing frame with the name of its topic
+MULTIPLEXED_TOPIC = Topic("nodar/multiplexed", 9826)
 
 
 # Function to retrieve reserved ports dynamically
@@ -53,4 +57,6 @@ def get_reserved_ports():
     reserved_ports.add(WAIT_TOPIC.port)
     reserved_ports.add(QA_FINDINGS_TOPIC.port)
     reserved_ports.add(NAVIGATION_TOPIC.port)
+    reserved_ports.add(CLOCK_SYNC_TOPIC.port)
+    reserved_ports.add(MULTIPLEXED_TOPIC.port)
     return reserved_ports
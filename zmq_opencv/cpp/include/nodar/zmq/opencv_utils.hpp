@@ -1,11 +1,57 @@
 #pragma once
 
+#include <memory>
 #include <nodar/zmq/image.hpp>
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
 
 namespace nodar {
 namespace zmq {
+
+/**
+ * A cv::MatAllocator for matrices that wrap the data of a received message instead of owning a copy of it.
+ * The UMatData of such a matrix holds a reference to the owner of the message,
+ * so the message stays alive until the last cv::Mat referencing it is released.
+ * This is the same mechanism that the OpenCV Python bindings use to wrap numpy arrays.
+ * Any new allocations are delegated to the standard OpenCV allocator.
+ */
+class MessageMatAllocator : public cv::MatAllocator {
+public:
+    static const MessageMatAllocator* instance() {
+        static const MessageMatAllocator allocator;
+        return &allocator;
+    }
+
+    cv::UMatData* wrap(uint8_t* data, size_t size, std::shared_ptr<const void> owner) const {
+        auto u = new cv::UMatData(this);
+        u->data = u->origdata = data;
+        u->size = size;
+        u->userdata = new std::shared_ptr<const void>(std::move(owner));
+        return u;
+    }
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags,
+                           cv::UMatUsageFlags usage_flags) const override {
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage_flags);
+    }
+
+    bool allocate(cv::UMatData* u, cv::AccessFlag access_flags, cv::UMatUsageFlags usage_flags) const override {
+        return cv::Mat::getStdAllocator()->allocate(u, access_flags, usage_flags);
+    }
+
+    void deallocate(cv::UMatData* u) const override {
+        if (not u) {
+            return;
+        }
+        CV_Assert(u->urefcount >= 0);
+        CV_Assert(u->refcount >= 0);
+        if (u->refcount == 0) {
+            delete static_cast<std::shared_ptr<const void>*>(u->userdata);
+            delete u;
+        }
+    }
+};
+
 inline cv::Mat cvMatFromStampedImage(const StampedImage& stamped_image) {
     cv::Mat mat(static_cast<int>(stamped_image.rows), static_cast<int>(stamped_image.cols),
                 static_cast<int>(stamped_image.type));
@@ -13,6 +59,36 @@ inline cv::Mat cvMatFromStampedImage(const StampedImage& stamped_image) {
     return mat;
 }
 
+inline cv::Mat cvMatFromStampedImage(const StampedImageView& stamped_image) {
+    cv::Mat mat(static_cast<int>(stamped_image.rows), static_cast<int>(stamped_image.cols),
+                static_cast<int>(stamped_image.type));
+    memcpy(mat.data, stamped_image.img.data(), stamped_image.img.size());
+    return mat;
+}
+
+/**
+ * Wrap the image data of a StampedImageView in a cv::Mat header without copying it.
+ * If the view owns its message, then the cv::Mat shares that ownership,
+ * and the message is released when both the view and every cv::Mat referencing it are gone.
+ * If the view does not own its message, then the cv::Mat is only valid as long as the message is alive.
+ *
+ * The cv::Mat aliases the received message, so treat it as read-only.
+ * If you need to modify the image in place, use cvMatFromStampedImage to get a copy.
+ */
+inline cv::Mat cvMatViewFromStampedImage(const StampedImageView& stamped_image) {
+    if (stamped_image.empty()) {
+        return {};
+    }
+    auto data = const_cast<uint8_t*>(stamped_image.img.data());
+    cv::Mat mat(static_cast<int>(stamped_image.rows), static_cast<int>(stamped_image.cols),
+                static_cast<int>(stamped_image.type), data);
+    if (stamped_image.owner) {
+        mat.u = MessageMatAllocator::instance()->wrap(data, stamped_image.img.size(), stamped_image.owner);
+        mat.addref();
+    }
+    return mat;
+}
+
 inline StampedImage stampedImageFromCvMat(uint64_t time, uint64_t frame_id, uint8_t cvt_to_bgr_code_arg,
                                           const cv::Mat& mat) {
     return StampedImage(time, frame_id, static_cast<uint32_t>(mat.rows), static_cast<uint32_t>(mat.cols),